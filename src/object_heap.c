@@ -157,7 +157,7 @@ object_heap_lookup_unlocked(object_heap_p heap, int id)
     object_base_p obj;
     int bucket_index, obj_index;
 
-    if ((id < heap->id_offset) || (id > (heap->heap_size + heap->id_offset))) {
+    if ((id < heap->id_offset) || (id >= (heap->heap_size + heap->id_offset))) {
         return NULL;
     }
     id &= OBJECT_HEAP_ID_MASK;
@@ -254,6 +254,72 @@ object_heap_free(object_heap_p heap, object_base_p obj)
     pthread_mutex_unlock(&heap->mutex);
 }
 
+/*
+ * Checks whether a bucket holds no allocated object
+ */
+static int
+object_heap_bucket_is_free(object_heap_p heap, int bucket_index)
+{
+    object_base_p obj;
+    int obj_index;
+
+    for (obj_index = 0; obj_index < heap->heap_increment; obj_index++) {
+        obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+        if (obj->next_free == ALLOCATED)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Releases trailing buckets that hold no allocated object
+ * Returns the number of bytes released
+ */
+unsigned int
+object_heap_trim(object_heap_p heap)
+{
+    object_base_p obj;
+    int bucket_index, obj_index, i;
+    int num_buckets, new_num_buckets, new_heap_size, next_free;
+    unsigned int released = 0;
+
+    pthread_mutex_lock(&heap->mutex);
+
+    /* Keep the first bucket, as allocated by object_heap_init() */
+    num_buckets = heap->heap_size / heap->heap_increment;
+    new_num_buckets = num_buckets;
+    while (new_num_buckets > 1 &&
+           object_heap_bucket_is_free(heap, new_num_buckets - 1))
+        new_num_buckets--;
+
+    if (new_num_buckets < num_buckets) {
+        for (i = new_num_buckets; i < num_buckets; i++) {
+            free(heap->bucket[i]);
+            heap->bucket[i] = NULL;
+        }
+        released = (num_buckets - new_num_buckets) *
+            heap->heap_increment * heap->object_size;
+
+        /* Rebuild the free list without the released objects */
+        new_heap_size = new_num_buckets * heap->heap_increment;
+        next_free = LAST_FREE;
+        for (i = new_heap_size; i-- > 0;) {
+            bucket_index = i / heap->heap_increment;
+            obj_index = i % heap->heap_increment;
+            obj = (object_base_p)(heap->bucket[bucket_index] + obj_index * heap->object_size);
+            if (obj->next_free != ALLOCATED) {
+                obj->next_free = next_free;
+                next_free = i;
+            }
+        }
+        heap->next_free = next_free;
+        heap->heap_size = new_heap_size;
+    }
+
+    pthread_mutex_unlock(&heap->mutex);
+    return released;
+}
+
 /*
  * Destroys a heap, the heap must be empty.
  */
@@ -90,6 +90,14 @@ void
 object_heap_free(object_heap_p heap, object_base_p obj)
     attribute_hidden;
 
+/*
+ * Releases trailing buckets that hold no allocated object
+ * Returns the number of bytes released
+ */
+unsigned int
+object_heap_trim(object_heap_p heap)
+    attribute_hidden;
+
 /*
  * Destroys a heap, the heap must be empty.
  */
@@ -22,6 +22,9 @@
 #include "utils.h"
 #include <time.h>
 #include <errno.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #define DEBUG 1
 #include "debug.h"
@@ -153,33 +156,57 @@ void delay_usec(unsigned int usec)
     } while (was_error && (errno == EINTR));
 }
 
-// Reallocates a BUFFER to NUM_ELEMENTS of ELEMENT_SIZE bytes
-void *
-realloc_buffer(
-    void        **buffer_p,
-    unsigned int *max_elements_p,
-    unsigned int  num_elements,
-    unsigned int  element_size
-)
+// Size of a transparent huge page on x86
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static int use_huge_pages(void)
 {
-    if (!buffer_p || !max_elements_p)
-        return NULL;
+    static int g_use_huge_pages = -1;
+    if (g_use_huge_pages < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_HUGE_PAGES", &g_use_huge_pages) < 0)
+            g_use_huge_pages = 1;
+    }
+    return g_use_huge_pages;
+}
 
-    void *buffer = *buffer_p;
-    if (*max_elements_p > num_elements)
-        return buffer;
+static int use_numa_local(void)
+{
+    static int g_use_numa_local = -1;
+    if (g_use_numa_local < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_NUMA_LOCAL", &g_use_numa_local) < 0)
+            g_use_numa_local = 0;
+    }
+    return g_use_numa_local;
+}
 
-    num_elements += 4;
-    if ((buffer = realloc(buffer, num_elements * element_size)) == NULL) {
-        free(*buffer_p);
-        *buffer_p = NULL;
-        return NULL;
+// Allocates a buffer of SIZE bytes, using huge pages for large buffers
+void *alloc_large_buffer(unsigned int size)
+{
+    void *buffer = NULL;
+
+#if defined(HAVE_POSIX_MEMALIGN)
+    if (size >= HUGE_PAGE_SIZE && use_huge_pages()) {
+        if (posix_memalign(&buffer, HUGE_PAGE_SIZE, size) != 0)
+            buffer = NULL;
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+        if (buffer)
+            madvise(buffer, size & -HUGE_PAGE_SIZE, MADV_HUGEPAGE);
+#endif
     }
-    memset((uint8_t *)buffer + *max_elements_p * element_size, 0,
-           (num_elements - *max_elements_p) * element_size);
+#endif
+    if (!buffer)
+        buffer = malloc(size);
+    if (!buffer)
+        return NULL;
 
-    *buffer_p = buffer;
-    *max_elements_p = num_elements;
+    /* Pages are placed on the node of the thread that first touches
+       them, so fault them in now from the calling thread */
+    if (size >= HUGE_PAGE_SIZE && use_numa_local()) {
+        const unsigned int page_size = use_huge_pages() ? HUGE_PAGE_SIZE : 4096;
+        unsigned int offset;
+        for (offset = 0; offset < size; offset += page_size)
+            ((volatile uint8_t *)buffer)[offset] = 0;
+    }
     return buffer;
 }
 
@@ -33,13 +33,8 @@ uint64_t get_ticks_usec(void)
 void delay_usec(unsigned int usec)
     attribute_hidden;
 
-void *
-realloc_buffer(
-    void        **buffer_p,
-    unsigned int *max_elements_p,
-    unsigned int  num_elements,
-    unsigned int  element_size
-) attribute_hidden;
+void *alloc_large_buffer(unsigned int size)
+    attribute_hidden;
 
 int find_string(const char *name, const char *ext, const char *sep)
     attribute_hidden;
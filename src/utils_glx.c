@@ -911,6 +911,7 @@ gl_create_pixmap_object(
     pixo->pixmap        = None;
     pixo->glx_pixmap    = None;
     pixo->is_bound      = 0;
+    pixo->is_dirty      = 0;
 
     XGetWindowAttributes(dpy, rootwin, &wattr);
     pixo->pixmap  = XCreatePixmap(dpy, rootwin, width, height, wattr.depth);
@@ -1042,6 +1043,7 @@ gl_bind_pixmap_object(GLPixmapObject *pixo)
     }
 
     pixo->is_bound = 1;
+    pixo->is_dirty = 0;
     return 1;
 }
 
@@ -1079,6 +1081,38 @@ gl_unbind_pixmap_object(GLPixmapObject *pixo)
     return 1;
 }
 
+/**
+ * gl_update_pixmap_object:
+ * @pixo: a #GLPixmapObject
+ *
+ * Makes the current contents of the @pixo pixmap available to GL
+ * without releasing the texture image. The pixmap is bound first if
+ * it was not already. Otherwise, if X rendered into the pixmap since
+ * the last update (@pixo->is_dirty), GL is fenced against the X
+ * stream with glXWaitX(), which avoids the glXReleaseTexImage() /
+ * glXBindTexImage() pair and the XSync() round trips they require.
+ *
+ * glXWaitX() only orders X requests of this client. Writes that do not
+ * go through them, e.g. VDPAU presentation to the pixmap, must have
+ * completed before this is called.
+ *
+ * Return value: 1 on success
+ */
+int
+gl_update_pixmap_object(GLPixmapObject *pixo)
+{
+    if (!pixo->is_bound)
+        return gl_bind_pixmap_object(pixo);
+
+    glBindTexture(pixo->target, pixo->texture);
+
+    if (pixo->is_dirty) {
+        glXWaitX();
+        pixo->is_dirty = 0;
+    }
+    return 1;
+}
+
 /**
  * gl_create_framebuffer_object:
  * @target: the target to which the texture is bound
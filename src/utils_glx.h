@@ -194,6 +194,7 @@ struct _GLPixmapObject {
     Pixmap          pixmap;
     GLXPixmap       glx_pixmap;
     unsigned int    is_bound    : 1;
+    unsigned int    is_dirty    : 1; /* X rendered into the pixmap since it was bound */
 };
 
 GLPixmapObject *
@@ -216,6 +217,10 @@ int
 gl_unbind_pixmap_object(GLPixmapObject *pixo)
     attribute_hidden;
 
+int
+gl_update_pixmap_object(GLPixmapObject *pixo)
+    attribute_hidden;
+
 typedef struct _GLFramebufferObject GLFramebufferObject;
 struct _GLFramebufferObject {
     unsigned int    width;
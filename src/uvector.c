@@ -0,0 +1,95 @@
+/*
+ *  uvector.c - Growable arrays
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "sysdeps.h"
+#include "uvector.h"
+
+// Grows vector storage to hold at least NUM_ELEMENTS of ELEMENT_SIZE bytes
+void *
+vector_grow(
+    void        **data_p,
+    unsigned int *max_elements_p,
+    void         *inline_data,
+    unsigned int  num_elements,
+    unsigned int  element_size
+)
+{
+    void *data = *data_p;
+    unsigned int max_elements = *max_elements_p;
+
+    if (max_elements >= num_elements)
+        return data;
+
+    /* Grow geometrically so that N appends cost O(N) overall */
+    max_elements = MAX(max_elements, 4);
+    while (max_elements < num_elements)
+        max_elements *= 2;
+
+    /* New slots are not cleared, callers always write before reading */
+    if (data == inline_data) {
+        data = malloc(max_elements * element_size);
+        if (!data)
+            return NULL;
+        memcpy(data, inline_data, *max_elements_p * element_size);
+    }
+    else {
+        data = realloc(data, max_elements * element_size);
+        if (!data)
+            return NULL;
+    }
+
+    *data_p = data;
+    *max_elements_p = max_elements;
+    return data;
+}
+
+// Shrinks vector storage to NUM_ELEMENTS, moving back to the inline storage if possible
+unsigned int
+vector_shrink_storage(
+    void        **data_p,
+    unsigned int *max_elements_p,
+    void         *inline_data,
+    unsigned int  num_inline_elements,
+    unsigned int  num_elements,
+    unsigned int  element_size
+)
+{
+    void *data = *data_p;
+    unsigned int max_elements = *max_elements_p;
+
+    if (data == inline_data || num_elements >= max_elements)
+        return 0;
+
+    if (num_elements <= num_inline_elements) {
+        memcpy(inline_data, data, num_elements * element_size);
+        free(data);
+        *data_p = inline_data;
+        *max_elements_p = num_inline_elements;
+        return max_elements * element_size;
+    }
+
+    data = realloc(data, num_elements * element_size);
+    if (!data)
+        return 0;
+
+    *data_p = data;
+    *max_elements_p = num_elements;
+    return (max_elements - num_elements) * element_size;
+}
@@ -0,0 +1,92 @@
+/*
+ *  uvector.h - Growable arrays
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#ifndef UVECTOR_H
+#define UVECTOR_H
+
+/* Declares a vector of TYPE with room for N_INLINE elements embedded in
+   the vector itself. The heap is only used once that storage overflows */
+#define UVECTOR(TYPE, N_INLINE)                 \
+    struct {                                    \
+        TYPE           *data;                   \
+        unsigned int    count;                  \
+        unsigned int    count_max;              \
+        TYPE            inline_data[N_INLINE];  \
+    }
+
+void *
+vector_grow(
+    void        **data_p,
+    unsigned int *max_elements_p,
+    void         *inline_data,
+    unsigned int  num_elements,
+    unsigned int  element_size
+) attribute_hidden;
+
+unsigned int
+vector_shrink_storage(
+    void        **data_p,
+    unsigned int *max_elements_p,
+    void         *inline_data,
+    unsigned int  num_inline_elements,
+    unsigned int  num_elements,
+    unsigned int  element_size
+) attribute_hidden;
+
+#define vector_init(vec) do {                                   \
+        (vec)->data      = (vec)->inline_data;                  \
+        (vec)->count     = 0;                                   \
+        (vec)->count_max = ARRAY_ELEMS((vec)->inline_data);     \
+    } while (0)
+
+#define vector_free(vec) do {                                   \
+        if ((vec)->data != (vec)->inline_data)                  \
+            free((vec)->data);                                  \
+        vector_init(vec);                                       \
+    } while (0)
+
+/* Makes sure at least NUM_ELEMENTS fit, returns 0 on allocation failure */
+#define vector_reserve(vec, num_elements)                       \
+    ((num_elements) <= (vec)->count_max ||                      \
+     vector_grow((void **)&(vec)->data, &(vec)->count_max,      \
+                 (vec)->inline_data, (num_elements),            \
+                 sizeof((vec)->data[0])) != NULL)
+
+/* Appends ELEM, returns 0 on allocation failure */
+#define vector_append(vec, elem)                                \
+    (vector_reserve(vec, (vec)->count + 1) ?                    \
+     ((vec)->data[(vec)->count++] = (elem), 1) : 0)
+
+/* Removes element at INDEX, replacing it with the last one */
+#define vector_remove_fast(vec, index)                          \
+    ((vec)->data[(index)] = (vec)->data[--(vec)->count])
+
+/* Shrinks storage to NUM_ELEMENTS (never below count), returns bytes released */
+#define vector_shrink(vec, num_elements)                        \
+    vector_shrink_storage((void **)&(vec)->data, &(vec)->count_max, \
+                          (vec)->inline_data,                   \
+                          ARRAY_ELEMS((vec)->inline_data),      \
+                          MAX((unsigned int)(num_elements), (vec)->count), \
+                          sizeof((vec)->data[0]))
+
+#define vector_clear(vec) \
+    ((vec)->count = 0)
+
+#endif /* UVECTOR_H */
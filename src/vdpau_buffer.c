@@ -18,16 +18,74 @@
  *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
  */
 
+#define _GNU_SOURCE 1 /* memfd_create() */
 #include "sysdeps.h"
 #include "vdpau_buffer.h"
 #include "vdpau_driver.h"
 #include "vdpau_video.h"
 #include "vdpau_dump.h"
 #include "utils.h"
+#include <unistd.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 
 #define DEBUG 1
 #include "debug.h"
 
+// Get whether VA images are allocated in memory shareable with other processes
+static int
+get_shared_images_env(void)
+{
+    static int g_shared_images = -1;
+    if (g_shared_images < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_SHARED_IMAGES", &g_shared_images) < 0)
+            g_shared_images = 0;
+    }
+    return g_shared_images;
+}
+
+// Allocates a buffer of SIZE bytes that other processes can map through *FD_P
+static void *
+alloc_shared_buffer(const char *name, unsigned int size, int *fd_p)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_MMAN_H)
+    void *buffer;
+    int fd;
+
+    fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    buffer = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (buffer == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    *fd_p = fd;
+    return buffer;
+#else
+    return NULL;
+#endif
+}
+
+// Releases a buffer allocated with alloc_shared_buffer()
+static void
+free_shared_buffer(void *buffer, unsigned int size, int fd)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_SYS_MMAN_H)
+    if (buffer)
+        munmap(buffer, size);
+    if (fd >= 0)
+        close(fd);
+#endif
+}
+
 // Destroy dead VA buffers
 void
 destroy_dead_va_buffers(
@@ -35,19 +93,16 @@ destroy_dead_va_buffers(
     object_context_p     obj_context
 )
 {
-    object_buffer_p obj_buffer;
-    unsigned int i;
-
-    if (obj_context->dead_buffers_count < 1)
-        return;
+    object_buffer_p obj_buffer, next_buffer;
 
-    ASSERT(obj_context->dead_buffers);
-    for (i = 0; i < obj_context->dead_buffers_count; i++) {
-        obj_buffer = VDPAU_BUFFER(obj_context->dead_buffers[i]);
-        ASSERT(obj_buffer);
+    /* Walk the intrusive list directly, no buffer ID lookups needed */
+    obj_buffer = obj_context->dead_buffers;
+    while (obj_buffer) {
+        next_buffer = obj_buffer->next_dead;
         destroy_va_buffer(driver_data, obj_buffer);
+        obj_buffer = next_buffer;
     }
-    obj_context->dead_buffers_count = 0;
+    obj_context->dead_buffers = NULL;
 }
 
 // Create VA buffer object
@@ -76,9 +131,38 @@ create_va_buffer(
     obj_buffer->max_num_elements = num_elements;
     obj_buffer->num_elements     = num_elements;
     obj_buffer->buffer_size      = size * num_elements;
-    obj_buffer->buffer_data      = malloc(obj_buffer->buffer_size);
     obj_buffer->mtime            = 0;
     obj_buffer->delayed_destroy  = 0;
+    obj_buffer->next_dead        = NULL;
+    obj_buffer->shared_fd        = -1;
+    obj_buffer->map_count        = 0;
+    obj_buffer->export_count     = 0;
+    obj_buffer->buffer_data      = NULL;
+
+    switch (buffer_type) {
+    case VAImageBufferType:
+        /* The memfd is exported through vaAcquireBufferHandle(), its
+           name only identifies the buffer in debugging tools */
+        if (get_shared_images_env()) {
+            char name[32];
+            snprintf(name, sizeof(name), "vdpau-video-buffer-0x%08x", buffer_id);
+            obj_buffer->buffer_data = alloc_shared_buffer(
+                name,
+                obj_buffer->buffer_size,
+                &obj_buffer->shared_fd
+            );
+            if (obj_buffer->buffer_data)
+                break;
+        }
+        /* fall-through */
+    case VASliceDataBufferType:
+        /* Frame-sized buffers, see alloc_large_buffer() */
+        obj_buffer->buffer_data  = alloc_large_buffer(obj_buffer->buffer_size);
+        break;
+    default:
+        obj_buffer->buffer_data  = malloc(obj_buffer->buffer_size);
+        break;
+    }
 
     if (!obj_buffer->buffer_data) {
         destroy_va_buffer(driver_data, obj_buffer);
@@ -97,7 +181,14 @@ destroy_va_buffer(
     if (!obj_buffer)
         return;
 
-    if (obj_buffer->buffer_data) {
+    if (obj_buffer->shared_fd >= 0) {
+        free_shared_buffer(obj_buffer->buffer_data,
+                           obj_buffer->buffer_size,
+                           obj_buffer->shared_fd);
+        obj_buffer->shared_fd = -1;
+        obj_buffer->buffer_data = NULL;
+    }
+    else if (obj_buffer->buffer_data) {
         free(obj_buffer->buffer_data);
         obj_buffer->buffer_data = NULL;
     }
@@ -115,16 +206,11 @@ schedule_destroy_va_buffer(
     if (!obj_context)
         return;
 
-    realloc_buffer(
-        (void **)&obj_context->dead_buffers,
-        &obj_context->dead_buffers_count_max,
-        16 + obj_context->dead_buffers_count,
-        sizeof(*obj_context->dead_buffers)
-    );
+    if (obj_buffer->delayed_destroy)
+        return;
 
-    ASSERT(obj_context->dead_buffers);
-    obj_context->dead_buffers[obj_context->dead_buffers_count] = obj_buffer->base.id;
-    obj_context->dead_buffers_count++;
+    obj_buffer->next_dead       = obj_context->dead_buffers;
+    obj_context->dead_buffers   = obj_buffer;
     obj_buffer->delayed_destroy = 1;
 }
 
@@ -232,6 +318,7 @@ vdpau_MapBuffer(
     if (obj_buffer->buffer_data == NULL)
         return VA_STATUS_ERROR_UNKNOWN;
 
+    ++obj_buffer->map_count;
     ++obj_buffer->mtime;
     return VA_STATUS_SUCCESS;
 }
@@ -249,6 +336,8 @@ vdpau_UnmapBuffer(
     if (!obj_buffer)
         return VA_STATUS_ERROR_INVALID_BUFFER;
 
+    if (obj_buffer->map_count > 0)
+        --obj_buffer->map_count;
     ++obj_buffer->mtime;
     return VA_STATUS_SUCCESS;
 }
@@ -290,3 +379,58 @@ vdpau_BufferInfo(
         *num_elements = obj_buffer->num_elements;
     return VA_STATUS_SUCCESS;
 }
+
+#if VA_CHECK_VERSION(0,36,0)
+// vaAcquireBufferHandle
+VAStatus
+vdpau_AcquireBufferHandle(
+    VADriverContextP    ctx,
+    VABufferID          buf_id,
+    VABufferInfo       *buf_info
+)
+{
+    VDPAU_DRIVER_DATA_INIT;
+
+    if (!buf_info)
+        return VA_STATUS_ERROR_INVALID_PARAMETER;
+
+    object_buffer_p obj_buffer = VDPAU_BUFFER(buf_id);
+    if (!obj_buffer)
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+
+    /* Only image buffers allocated with VDPAU_VIDEO_SHARED_IMAGES=yes
+       are backed by a descriptor that can be handed out */
+    if (obj_buffer->shared_fd < 0)
+        return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
+    if (buf_info->mem_type &&
+        !(buf_info->mem_type & VDPAU_VIDEO_MEM_TYPE_MEMFD))
+        return VA_STATUS_ERROR_UNSUPPORTED_MEMORY_TYPE;
+
+    buf_info->handle   = (uintptr_t)obj_buffer->shared_fd;
+    buf_info->type     = obj_buffer->type;
+    buf_info->mem_type = VDPAU_VIDEO_MEM_TYPE_MEMFD;
+    buf_info->mem_size = obj_buffer->buffer_size;
+    ++obj_buffer->export_count;
+    return VA_STATUS_SUCCESS;
+}
+
+// vaReleaseBufferHandle
+VAStatus
+vdpau_ReleaseBufferHandle(
+    VADriverContextP    ctx,
+    VABufferID          buf_id
+)
+{
+    VDPAU_DRIVER_DATA_INIT;
+
+    object_buffer_p obj_buffer = VDPAU_BUFFER(buf_id);
+    if (!obj_buffer)
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+
+    /* The descriptor stays owned by the buffer, nothing to close here */
+    if (obj_buffer->export_count == 0)
+        return VA_STATUS_ERROR_INVALID_BUFFER;
+    --obj_buffer->export_count;
+    return VA_STATUS_SUCCESS;
+}
+#endif
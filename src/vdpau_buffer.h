@@ -26,16 +26,27 @@
 typedef struct object_buffer object_buffer_t;
 struct object_buffer {
     struct object_base  base;
-    VAContextID         va_context;
-    VABufferType        type;
     void               *buffer_data;
-    unsigned int        buffer_size;
-    unsigned int        max_num_elements;
+    VABufferType        type;
     unsigned int        num_elements;
+    unsigned int        buffer_size;
+    VAContextID         va_context;
     uint64_t            mtime;
     unsigned int        delayed_destroy : 1;
+    unsigned int        max_num_elements;
+    object_buffer_p     next_dead;
+    int                 shared_fd;
+    unsigned int        map_count;
+    unsigned int        export_count;
 };
 
+/* Memory type reported by vaAcquireBufferHandle() for image buffers
+   allocated with VDPAU_VIDEO_SHARED_IMAGES=yes. The handle is a memfd
+   of mem_size bytes that can be mmap()ed with MAP_SHARED, also from
+   another process it is passed to. The descriptor remains owned by the
+   buffer: dup() it to keep the memory past vaDestroyBuffer() */
+#define VDPAU_VIDEO_MEM_TYPE_MEMFD 0x00010000
+
 // Destroy dead VA buffers
 void
 destroy_dead_va_buffers(
@@ -129,4 +140,21 @@ vdpau_BufferInfo(
     unsigned int       *num_elements
 ) attribute_hidden;
 
+#if VA_CHECK_VERSION(0,36,0)
+// vaAcquireBufferHandle
+VAStatus
+vdpau_AcquireBufferHandle(
+    VADriverContextP    ctx,
+    VABufferID          buf_id,
+    VABufferInfo       *buf_info
+) attribute_hidden;
+
+// vaReleaseBufferHandle
+VAStatus
+vdpau_ReleaseBufferHandle(
+    VADriverContextP    ctx,
+    VABufferID          buf_id
+) attribute_hidden;
+#endif
+
 #endif /* VDPAU_BUFFER_H */
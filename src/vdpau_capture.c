@@ -0,0 +1,315 @@
+/*
+ *  vdpau_capture.c - VDPAU backend for VA-API (composited output capture)
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "sysdeps.h"
+#include "vdpau_capture.h"
+#include "uasyncqueue.h"
+#include "utils.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define DEBUG 1
+#include "debug.h"
+
+#define CAPTURE_HEADER_SIZE 4096
+
+struct vdpau_capture {
+    vdpau_driver_data_t        *driver_data;
+    char                        name[64];
+    int                         fd;
+    vdpau_capture_ring_t       *ring;
+    unsigned int                ring_size;
+    pthread_t                   thread;
+    UAsyncQueue                *queue;
+    pthread_mutex_t             mutex;
+    pthread_cond_t              cond;
+    VdpOutputSurface            pending_surface;  /* flipped, not read back yet */
+    unsigned int                pending_width;
+    unsigned int                pending_height;
+    VdpOutputSurface            busy_surface;     /* being read back */
+    unsigned int                quit            : 1;
+};
+
+// Get the XID of the drawable to capture (0: none)
+static unsigned long
+get_capture_drawable_env(void)
+{
+    static int g_capture_drawable_init = 0;
+    static unsigned long g_capture_drawable;
+    if (!g_capture_drawable_init) {
+        /* XIDs are usually written in hexadecimal, as xwininfo does */
+        const char * const env_str = getenv("VDPAU_VIDEO_CAPTURE_DRAWABLE");
+        g_capture_drawable = env_str ? strtoul(env_str, NULL, 0) : 0;
+        g_capture_drawable_init = 1;
+    }
+    return g_capture_drawable;
+}
+
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+// Make sure ring slots can hold SLOT_SIZE bytes. Called from the worker only
+static int
+capture_ensure_ring(vdpau_capture_t *capture, unsigned int slot_size)
+{
+    vdpau_capture_ring_t *ring = capture->ring;
+    unsigned int ring_size;
+
+    if (ring && ring->slot_size >= slot_size)
+        return 1;
+
+    /* Frames only grow the ring, so that readers remap at most a few times */
+    ring_size = CAPTURE_HEADER_SIZE + VDPAU_CAPTURE_SLOTS * slot_size;
+    if (ftruncate(capture->fd, ring_size) < 0)
+        return 0;
+
+    if (ring)
+        munmap(ring, capture->ring_size);
+    ring = mmap(NULL, ring_size, PROT_READ|PROT_WRITE, MAP_SHARED, capture->fd, 0);
+    if (ring == MAP_FAILED) {
+        capture->ring = NULL;
+        return 0;
+    }
+    capture->ring      = ring;
+    capture->ring_size = ring_size;
+
+    ring->magic        = VDPAU_CAPTURE_MAGIC;
+    ring->rgba_format  = VDP_RGBA_FORMAT_B8G8R8A8;
+    ring->num_slots    = VDPAU_CAPTURE_SLOTS;
+    ring->data_offset  = CAPTURE_HEADER_SIZE;
+    __atomic_store_n(&ring->slot_size, slot_size, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Read SURFACE back into the next ring slot. Called from the worker only
+static void
+capture_read_surface(
+    vdpau_capture_t     *capture,
+    VdpOutputSurface     surface,
+    unsigned int         width,
+    unsigned int         height
+)
+{
+    const unsigned int stride = width * 4;
+
+    if (!capture_ensure_ring(capture, stride * height))
+        return;
+
+    vdpau_capture_ring_t * const ring = capture->ring;
+    const uint32_t count = ring->write_count;
+    vdpau_capture_slot_t * const slot = &ring->slots[count % VDPAU_CAPTURE_SLOTS];
+    const uint32_t sequence = slot->sequence;
+    uint8_t *dst = (uint8_t *)ring + ring->data_offset +
+        (count % VDPAU_CAPTURE_SLOTS) * ring->slot_size;
+    uint32_t dst_stride = stride;
+    VdpRect src_rect;
+    VdpStatus vdp_status;
+
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    /* This waits for the rendering of SURFACE to complete */
+    src_rect.x0 = 0;
+    src_rect.y0 = 0;
+    src_rect.x1 = width;
+    src_rect.y1 = height;
+    vdp_status = vdpau_output_surface_get_bits_native(
+        capture->driver_data,
+        surface,
+        &src_rect,
+        &dst,
+        &dst_stride
+    );
+    slot->width     = src_rect.x1;
+    slot->height    = src_rect.y1;
+    slot->stride    = stride;
+    slot->timestamp = get_ticks_usec();
+
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+    if (!VDPAU_CHECK_STATUS(vdp_status, "VdpOutputSurfaceGetBitsNative()"))
+        return;
+    __atomic_store_n(&ring->write_count, count + 1, __ATOMIC_RELEASE);
+}
+
+// Worker thread: reads flipped output surfaces back into the ring
+static void *
+capture_thread(void *arg)
+{
+    vdpau_capture_t * const capture = arg;
+    VdpOutputSurface surface;
+    unsigned int width, height;
+
+    for (;;) {
+        async_queue_pop(capture->queue);
+
+        pthread_mutex_lock(&capture->mutex);
+        if (capture->quit) {
+            pthread_mutex_unlock(&capture->mutex);
+            break;
+        }
+        surface = capture->pending_surface;
+        width   = capture->pending_width;
+        height  = capture->pending_height;
+        capture->pending_surface = VDP_INVALID_HANDLE;
+        capture->busy_surface    = surface;
+        pthread_mutex_unlock(&capture->mutex);
+
+        if (surface == VDP_INVALID_HANDLE)
+            continue;
+        capture_read_surface(capture, surface, width, height);
+
+        pthread_mutex_lock(&capture->mutex);
+        capture->busy_surface = VDP_INVALID_HANDLE;
+        pthread_cond_broadcast(&capture->cond);
+        pthread_mutex_unlock(&capture->mutex);
+    }
+    return NULL;
+}
+#endif
+
+// Create capture state for DRAWABLE, if capture was requested for it
+vdpau_capture_t *
+capture_create(vdpau_driver_data_t *driver_data, Drawable drawable)
+{
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+    const unsigned long capture_drawable = get_capture_drawable_env();
+    vdpau_capture_t *capture;
+
+    if (!capture_drawable || (Drawable)capture_drawable != drawable)
+        return NULL;
+
+    capture = calloc(1, sizeof(*capture));
+    if (!capture)
+        return NULL;
+
+    capture->driver_data     = driver_data;
+    capture->pending_surface = VDP_INVALID_HANDLE;
+    capture->busy_surface    = VDP_INVALID_HANDLE;
+    capture->queue = async_queue_new();
+    if (!capture->queue)
+        goto error_queue;
+
+    snprintf(capture->name, sizeof(capture->name),
+             "/vdpau-video-capture-%lu", (unsigned long)drawable);
+    capture->fd = shm_open(capture->name, O_RDWR|O_CREAT|O_TRUNC, 0600);
+    if (capture->fd < 0)
+        goto error_shm;
+
+    pthread_mutex_init(&capture->mutex, NULL);
+    pthread_cond_init(&capture->cond, NULL);
+    if (pthread_create(&capture->thread, NULL, capture_thread, capture) != 0)
+        goto error_thread;
+
+    vdpau_information_message("capturing drawable 0x%08lx into %s\n",
+                              (unsigned long)drawable, capture->name);
+    return capture;
+
+error_thread:
+    pthread_cond_destroy(&capture->cond);
+    pthread_mutex_destroy(&capture->mutex);
+    close(capture->fd);
+    shm_unlink(capture->name);
+error_shm:
+    async_queue_free(capture->queue);
+error_queue:
+    free(capture);
+    return NULL;
+#else
+    return NULL;
+#endif
+}
+
+// Destroy capture state, waiting for the readback in progress
+void
+capture_destroy(vdpau_capture_t *capture)
+{
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+    if (!capture)
+        return;
+
+    pthread_mutex_lock(&capture->mutex);
+    capture->quit = 1;
+    pthread_mutex_unlock(&capture->mutex);
+    async_queue_push(capture->queue, capture);
+    pthread_join(capture->thread, NULL);
+
+    if (capture->ring)
+        munmap(capture->ring, capture->ring_size);
+    close(capture->fd);
+    shm_unlink(capture->name);
+    async_queue_free(capture->queue);
+    pthread_cond_destroy(&capture->cond);
+    pthread_mutex_destroy(&capture->mutex);
+    free(capture);
+#endif
+}
+
+// Wait for the worker to be done with SURFACE, e.g. before rendering to it
+void
+capture_wait_idle(vdpau_capture_t *capture, VdpOutputSurface surface)
+{
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+    if (!capture)
+        return;
+
+    pthread_mutex_lock(&capture->mutex);
+    if (surface == VDP_INVALID_HANDLE || capture->pending_surface == surface)
+        capture->pending_surface = VDP_INVALID_HANDLE;
+    while (capture->busy_surface != VDP_INVALID_HANDLE &&
+           (surface == VDP_INVALID_HANDLE || capture->busy_surface == surface))
+        pthread_cond_wait(&capture->cond, &capture->mutex);
+    pthread_mutex_unlock(&capture->mutex);
+#endif
+}
+
+// Forget the queued output surfaces, e.g. before they are destroyed
+void
+capture_discard(vdpau_capture_t *capture)
+{
+    capture_wait_idle(capture, VDP_INVALID_HANDLE);
+}
+
+// Queue SURFACE, which was just flipped, for readback by the worker
+void
+capture_output_surface(
+    vdpau_capture_t     *capture,
+    VdpOutputSurface     surface,
+    unsigned int         width,
+    unsigned int         height
+)
+{
+#if defined(HAVE_SHM_OPEN) && defined(HAVE_SYS_MMAN_H)
+    int needs_wakeup;
+
+    /* A frame the worker has not picked up yet is replaced, so that a
+       slow readback drops frames instead of delaying vaPutSurface() */
+    pthread_mutex_lock(&capture->mutex);
+    needs_wakeup = capture->pending_surface == VDP_INVALID_HANDLE;
+    capture->pending_surface = surface;
+    capture->pending_width   = width;
+    capture->pending_height  = height;
+    pthread_mutex_unlock(&capture->mutex);
+
+    if (needs_wakeup)
+        async_queue_push(capture->queue, capture);
+#endif
+}
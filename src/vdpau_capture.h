@@ -0,0 +1,91 @@
+/*
+ *  vdpau_capture.h - VDPAU backend for VA-API (composited output capture)
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#ifndef VDPAU_CAPTURE_H
+#define VDPAU_CAPTURE_H
+
+#include "vdpau_driver.h"
+
+/* The capture ring of a drawable lives in the POSIX shared memory object
+   "/vdpau-video-capture-<XID>", laid out as a vdpau_capture_ring header
+   followed by VDPAU_CAPTURE_SLOTS frames of slot_size bytes each.
+
+   The ring is filled by a worker thread, off the vaPutSurface() path,
+   so there is a single writer. A slot sequence number is odd while the
+   frame is being written; readers copy a slot out and retry if the
+   sequence number changed or was odd. write_count is the number of
+   frames published so far, the latest one is in slot
+   (write_count - 1) % VDPAU_CAPTURE_SLOTS. Readers remap the object if
+   slot_size grows */
+#define VDPAU_CAPTURE_MAGIC     0x43504456 /* 'VDPC' */
+#define VDPAU_CAPTURE_SLOTS     4
+
+typedef struct vdpau_capture_slot vdpau_capture_slot_t;
+struct vdpau_capture_slot {
+    uint32_t                    sequence;
+    uint32_t                    width;
+    uint32_t                    height;
+    uint32_t                    stride;
+    uint64_t                    timestamp;      /* usec, CLOCK_REALTIME */
+};
+
+typedef struct vdpau_capture_ring vdpau_capture_ring_t;
+struct vdpau_capture_ring {
+    uint32_t                    magic;
+    uint32_t                    rgba_format;    /* VdpRGBAFormat */
+    uint32_t                    num_slots;
+    uint32_t                    slot_size;
+    uint32_t                    data_offset;    /* offset of the first slot */
+    uint32_t                    write_count;
+    vdpau_capture_slot_t        slots[VDPAU_CAPTURE_SLOTS];
+};
+
+typedef struct vdpau_capture vdpau_capture_t;
+
+// Create capture state for DRAWABLE, if capture was requested for it
+vdpau_capture_t *
+capture_create(vdpau_driver_data_t *driver_data, Drawable drawable)
+    attribute_hidden;
+
+// Destroy capture state, waiting for the readback in progress
+void
+capture_destroy(vdpau_capture_t *capture)
+    attribute_hidden;
+
+// Queue SURFACE, which was just flipped, for readback by the worker
+void
+capture_output_surface(
+    vdpau_capture_t     *capture,
+    VdpOutputSurface     surface,
+    unsigned int         width,
+    unsigned int         height
+) attribute_hidden;
+
+// Wait for the worker to be done with SURFACE, e.g. before rendering to it
+void
+capture_wait_idle(vdpau_capture_t *capture, VdpOutputSurface surface)
+    attribute_hidden;
+
+// Forget the queued output surfaces, e.g. before they are destroyed
+void
+capture_discard(vdpau_capture_t *capture)
+    attribute_hidden;
+
+#endif /* VDPAU_CAPTURE_H */
@@ -132,32 +132,98 @@ check_decoder(
     return VA_STATUS_SUCCESS;
 }
 
+// Returns the maximum level the VDPAU implementation supports for profile
+static uint32_t
+get_max_level(
+    vdpau_driver_data_t *driver_data,
+    VdpDecoderProfile    profile
+)
+{
+    VdpBool is_supported = VDP_FALSE;
+    VdpStatus vdp_status;
+    uint32_t max_level, max_references, max_width, max_height;
+
+    vdp_status = vdpau_decoder_query_capabilities(
+        driver_data,
+        driver_data->vdp_device,
+        profile,
+        &is_supported,
+        &max_level,
+        &max_references,
+        &max_width,
+        &max_height
+    );
+    if (!VDPAU_CHECK_STATUS(vdp_status, "VdpDecoderQueryCapabilities()") ||
+        !is_supported)
+        return 0;
+    return max_level;
+}
+
+// H.264 MaxDpbMbs limits (Table A-1)
+typedef struct {
+    uint32_t level_idc;
+    uint32_t max_dpb_mbs;
+} h264_level_limits_t;
+
+static const h264_level_limits_t h264_level_limits[] = {
+    { 10,    396 }, { 11,    900 }, { 12,   2376 }, { 13,   2376 },
+    { 20,   2376 }, { 21,   4752 }, { 22,   8100 }, { 30,   8100 },
+    { 31,  18000 }, { 32,  20480 }, { 40,  32768 }, { 41,  32768 },
+    { 42,  34816 }, { 50, 110400 }, { 51, 184320 }, { 52, 184320 },
+};
+
 // Computes value for VdpDecoderCreate()::max_references parameter
 static int
 get_max_ref_frames(
     VdpDecoderProfile profile,
+    uint32_t          level,
     unsigned int      width,
     unsigned int      height
 )
 {
     int max_ref_frames = 2;
+    unsigned int i;
 
     switch (profile) {
+    case VDP_DECODER_PROFILE_H264_BASELINE:
     case VDP_DECODER_PROFILE_H264_MAIN:
     case VDP_DECODER_PROFILE_H264_HIGH:
     {
-        /* level 4.1 limits */
-        unsigned int aligned_width  = (width + 15) & -16;
-        unsigned int aligned_height = (height + 15) & -16;
-        unsigned int surface_size   = (aligned_width * aligned_height * 3) / 2;
-        if ((max_ref_frames = (12 * 1024 * 1024) / surface_size) > 16)
+        /* Use the limits of the highest level not above LEVEL */
+        uint32_t max_dpb_mbs = h264_level_limits[0].max_dpb_mbs;
+        for (i = 0; i < ARRAY_ELEMS(h264_level_limits); i++) {
+            if (h264_level_limits[i].level_idc > level)
+                break;
+            max_dpb_mbs = h264_level_limits[i].max_dpb_mbs;
+        }
+
+        unsigned int width_mbs  = (width  + 15) / 16;
+        unsigned int height_mbs = (height + 15) / 16;
+        max_ref_frames = max_dpb_mbs / (width_mbs * height_mbs);
+        if (max_ref_frames > 16)
             max_ref_frames = 16;
+        else if (max_ref_frames < 1)
+            max_ref_frames = 1;
         break;
     }
+    default:
+        break;
     }
     return max_ref_frames;
 }
 
+// Check whether decoders should be sized for the worst case up front
+static int
+get_decoder_max_refs_env(void)
+{
+    static int g_decoder_max_refs = -1;
+    if (g_decoder_max_refs < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_DECODER_MAX_REFS", &g_decoder_max_refs) < 0)
+            g_decoder_max_refs = 0;
+    }
+    return g_decoder_max_refs;
+}
+
 // Returns the maximum number of reference frames of a decode session
 static inline int get_num_ref_frames(object_context_p obj_context)
 {
@@ -178,12 +244,25 @@ ensure_decoder_with_max_refs(
 
     if (max_ref_frames < 0)
         max_ref_frames =
-            get_max_ref_frames(obj_context->vdp_profile,
+            get_max_ref_frames(obj_context->vdp_profile, 41,
                                obj_context->picture_width,
                                obj_context->picture_height);
 
     if (obj_context->vdp_decoder == VDP_INVALID_HANDLE ||
         obj_context->max_ref_frames < max_ref_frames) {
+        /* Size the decoder for the largest DPB the hardware level
+           allows if requested, or if the stream already outgrew the
+           decoder once, so that it is never recreated mid-stream */
+        if (get_decoder_max_refs_env() ||
+            obj_context->vdp_decoder != VDP_INVALID_HANDLE) {
+            const uint32_t max_level =
+                get_max_level(driver_data, obj_context->vdp_profile);
+            max_ref_frames = MAX(max_ref_frames,
+                                 get_max_ref_frames(obj_context->vdp_profile,
+                                                    max_level,
+                                                    obj_context->picture_width,
+                                                    obj_context->picture_height));
+        }
         obj_context->max_ref_frames = max_ref_frames;
 
         if (obj_context->vdp_decoder != VDP_INVALID_HANDLE) {
@@ -191,6 +270,7 @@ ensure_decoder_with_max_refs(
             obj_context->vdp_decoder = VDP_INVALID_HANDLE;
         }
 
+        const uint64_t start_ticks = get_ticks_usec();
         vdp_status = vdpau_decoder_create(
             driver_data,
             driver_data->vdp_device,
@@ -200,12 +280,52 @@ ensure_decoder_with_max_refs(
             max_ref_frames,
             &obj_context->vdp_decoder
         );
+        obj_context->decoder_create_usec += get_ticks_usec() - start_ticks;
         if (!VDPAU_CHECK_STATUS(vdp_status, "VdpDecoderCreate()"))
             return vdp_status;
     }
     return VDP_STATUS_OK;
 }
 
+// Check whether decoders are to be created at vaCreateContext() time
+static int
+get_decoder_eager_env(void)
+{
+    static int g_decoder_eager = -1;
+    if (g_decoder_eager < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_DECODER_EAGER", &g_decoder_eager) < 0)
+            g_decoder_eager = 0;
+    }
+    return g_decoder_eager;
+}
+
+// Creates the decoder ahead of the first picture (VDPAU_VIDEO_DECODER_EAGER)
+VAStatus
+warmup_decoder(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context
+)
+{
+    VdpStatus vdp_status;
+
+    if (!get_decoder_eager_env())
+        return VA_STATUS_SUCCESS;
+
+    /* The number of references is not known before the first picture,
+       use the level 4.1 defaults. The decoder is recreated if needed */
+    vdp_status = ensure_decoder_with_max_refs(driver_data, obj_context, -1);
+    if (vdp_status != VDP_STATUS_OK)
+        return vdpau_get_VAStatus(vdp_status);
+
+    /* Preallocate room for a typical number of slices per picture */
+    if (!vector_reserve(&obj_context->vdp_bitstream_buffers, 32))
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    memset(obj_context->vdp_bitstream_buffers.data, 0,
+           obj_context->vdp_bitstream_buffers.count_max *
+           sizeof(obj_context->vdp_bitstream_buffers.data[0]));
+    return VA_STATUS_SUCCESS;
+}
+
 // Lazy allocate (generated) slice data buffer. Buffer lives until vaDestroyContext()
 static uint8_t *
 alloc_gen_slice_data(object_context_p obj_context, unsigned int size)
@@ -229,18 +349,56 @@ alloc_gen_slice_data(object_context_p obj_context, unsigned int size)
 static VdpBitstreamBuffer *
 alloc_VdpBitstreamBuffer(object_context_p obj_context)
 {
-    VdpBitstreamBuffer *vdp_bitstream_buffers;
-
-    vdp_bitstream_buffers = realloc_buffer(
-        (void **)&obj_context->vdp_bitstream_buffers,
-        &obj_context->vdp_bitstream_buffers_count_max,
-        1 + obj_context->vdp_bitstream_buffers_count,
-        sizeof(*obj_context->vdp_bitstream_buffers)
-    );
-    if (!vdp_bitstream_buffers)
+    if (!vector_reserve(&obj_context->vdp_bitstream_buffers,
+                        1 + obj_context->vdp_bitstream_buffers.count))
         return NULL;
 
-    return &vdp_bitstream_buffers[obj_context->vdp_bitstream_buffers_count++];
+    return &obj_context->vdp_bitstream_buffers.data[obj_context->vdp_bitstream_buffers.count++];
+}
+
+// Shrinks per-picture scratch storage to the peak usage since the last trim
+static unsigned int
+trim_context_memory(object_context_p obj_context)
+{
+    unsigned int released = 0;
+    unsigned int size;
+
+    size = MAX(obj_context->gen_slice_data_size_peak,
+               obj_context->gen_slice_data_size);
+    if (size < obj_context->gen_slice_data_size_max) {
+        if (size == 0) {
+            free(obj_context->gen_slice_data);
+            obj_context->gen_slice_data = NULL;
+        }
+        else {
+            uint8_t *gen_slice_data = realloc(obj_context->gen_slice_data, size);
+            if (!gen_slice_data)
+                size = obj_context->gen_slice_data_size_max;
+            else
+                obj_context->gen_slice_data = gen_slice_data;
+        }
+        released += obj_context->gen_slice_data_size_max - size;
+        obj_context->gen_slice_data_size_max = size;
+    }
+
+    released += vector_shrink(&obj_context->vdp_bitstream_buffers,
+                              obj_context->vdp_bitstream_buffers_peak);
+
+    obj_context->gen_slice_data_size_peak   = 0;
+    obj_context->vdp_bitstream_buffers_peak = 0;
+    return released;
+}
+
+// Get the number of pictures between two memory trims (0: disabled)
+static int
+get_trim_interval(void)
+{
+    static int g_trim_interval = -1;
+    if (g_trim_interval < 0) {
+        if (getenv_int("VDPAU_VIDEO_TRIM_INTERVAL", &g_trim_interval) < 0)
+            g_trim_interval = 0;
+    }
+    return g_trim_interval;
 }
 
 // Append VASliceDataBuffer hunk into VDPAU buffer
@@ -492,7 +650,7 @@ translate_VASliceDataBuffer(
 
 #if USE_VDPAU_MPEG4
     if (obj_context->vdp_codec == VDP_CODEC_MPEG4 &&
-        obj_context->vdp_bitstream_buffers_count == 0) {
+        obj_context->vdp_bitstream_buffers.count == 0) {
         PutBitContext pb;
         uint8_t slice_header_buffer[32];
         uint8_t *slice_header;
@@ -628,6 +786,27 @@ translate_VAPictureParameterBufferMPEG2(
     return 1;
 }
 
+// Check whether IQ_MATRIX differs from the one of the previous picture
+static int
+iq_matrix_changed(
+    object_context_p    obj_context,
+    const void         *iq_matrix,
+    unsigned int        iq_matrix_size
+)
+{
+    ASSERT(iq_matrix_size <= sizeof(obj_context->last_iq_matrix));
+
+    /* The translated matrices persist in vdp_picture_info, so they
+       don't need to be rebuilt if the VA buffer is unchanged */
+    if (obj_context->last_iq_matrix_size == iq_matrix_size &&
+        memcmp(&obj_context->last_iq_matrix, iq_matrix, iq_matrix_size) == 0)
+        return 0;
+
+    memcpy(&obj_context->last_iq_matrix, iq_matrix, iq_matrix_size);
+    obj_context->last_iq_matrix_size = iq_matrix_size;
+    return 1;
+}
+
 // Translate VAIQMatrixBufferMPEG2
 static int
 translate_VAIQMatrixBufferMPEG2(
@@ -644,6 +823,9 @@ translate_VAIQMatrixBufferMPEG2(
     const uint8_t *inter_matrix_lookup;
     int i;
 
+    if (!iq_matrix_changed(obj_context, iq_matrix, sizeof(*iq_matrix)))
+        return 1;
+
     if (iq_matrix->load_intra_quantiser_matrix) {
         intra_matrix = iq_matrix->intra_quantiser_matrix;
         intra_matrix_lookup = ff_zigzag_direct;
@@ -761,6 +943,9 @@ translate_VAIQMatrixBufferMPEG4(
     const uint8_t *inter_matrix_lookup;
     int i;
 
+    if (!iq_matrix_changed(obj_context, iq_matrix, sizeof(*iq_matrix)))
+        return 1;
+
     if (iq_matrix->load_intra_quant_mat) {
         intra_matrix = iq_matrix->intra_quant_mat;
         intra_matrix_lookup = ff_zigzag_direct;
@@ -863,6 +1048,9 @@ translate_VAIQMatrixBufferH264(
     VAIQMatrixBufferH264 * const iq_matrix = obj_buffer->buffer_data;
     int i, j;
 
+    if (!iq_matrix_changed(obj_context, iq_matrix, sizeof(*iq_matrix)))
+        return 1;
+
     if (sizeof(pic_info->scaling_lists_4x4) == sizeof(iq_matrix->ScalingList4x4))
         memcpy(pic_info->scaling_lists_4x4, iq_matrix->ScalingList4x4,
                sizeof(pic_info->scaling_lists_4x4));
@@ -1132,6 +1320,69 @@ vdpau_QueryConfigEntrypoints(
     return VA_STATUS_SUCCESS;
 }
 
+// Check whether the current picture is used as a reference
+static int
+is_reference_picture(object_context_p obj_context)
+{
+    switch (obj_context->vdp_codec) {
+    case VDP_CODEC_MPEG1:
+    case VDP_CODEC_MPEG2:
+        /* B-pictures */
+        return obj_context->vdp_picture_info.mpeg2.picture_coding_type != 3;
+#if HAVE_VDPAU_MPEG4
+    case VDP_CODEC_MPEG4:
+        /* B-VOPs */
+        return obj_context->vdp_picture_info.mpeg4.vop_coding_type != 2;
+#endif
+    case VDP_CODEC_H264:
+        return obj_context->vdp_picture_info.h264.is_reference;
+    case VDP_CODEC_VC1:
+        /* B and BI pictures */
+        return (obj_context->vdp_picture_info.vc1.picture_type != 3 &&
+                obj_context->vdp_picture_info.vc1.picture_type != 4);
+    default:
+        break;
+    }
+    return 1;
+}
+
+// Get the display queue depth from which pictures are shed (0: disabled)
+static int
+get_shed_queue_depth(void)
+{
+    static int g_shed_queue_depth = -1;
+    if (g_shed_queue_depth < 0) {
+        if (getenv_int("VDPAU_VIDEO_SHED_QUEUE_DEPTH", &g_shed_queue_depth) < 0)
+            g_shed_queue_depth = 0;
+    }
+    return g_shed_queue_depth;
+}
+
+// Check whether the current picture can be dropped to catch up
+static int
+should_shed_picture(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context
+)
+{
+    const int shed_queue_depth = get_shed_queue_depth();
+    if (shed_queue_depth <= 0)
+        return 0;
+
+    if (is_reference_picture(obj_context))
+        return 0;
+
+    if (obj_context->num_render_targets < shed_queue_depth)
+        return 0;
+
+    /* Count decoded pictures that are still waiting to be displayed */
+    unsigned int queue_depth;
+    queue_depth = count_displaying_surfaces(driver_data,
+                                            obj_context->render_targets,
+                                            obj_context->num_render_targets);
+    return queue_depth >= (unsigned int)shed_queue_depth;
+}
+
 // vaBeginPicture
 VAStatus
 vdpau_BeginPicture(
@@ -1150,13 +1401,38 @@ vdpau_BeginPicture(
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
 
+    /* A speculative readback of the previous picture is now stale */
+    readahead_cancel(obj_context->readahead, obj_surface->vdp_surface);
+
+    /* Record the previous picture usage before scratch storage is reset */
+    obj_context->gen_slice_data_size_peak    =
+        MAX(obj_context->gen_slice_data_size_peak,
+            obj_context->gen_slice_data_size);
+    obj_context->vdp_bitstream_buffers_peak  =
+        MAX(obj_context->vdp_bitstream_buffers_peak,
+            obj_context->vdp_bitstream_buffers.count);
+
+    const int trim_interval = get_trim_interval();
+    if (trim_interval > 0 && ++obj_context->trim_pictures >= trim_interval) {
+        obj_context->trim_pictures = 0;
+        /* Other contexts may be decoding on other threads, so only this
+           context's scratch storage is trimmed here */
+        trim_context_memory(obj_context);
+        vdpau_trim_memory(driver_data);
+    }
+
     obj_surface->va_surface_status           = VASurfaceRendering;
+    obj_surface->is_shed                     = 0;
+    obj_surface->mirror_output_id            = VA_INVALID_ID;
+    obj_surface->update_count++;
+    if (!obj_context->first_picture_ticks)
+        obj_context->first_picture_ticks     = get_ticks_usec();
     obj_context->last_pic_param              = NULL;
     obj_context->last_slice_params           = NULL;
     obj_context->last_slice_params_count     = 0;
     obj_context->current_render_target       = obj_surface->base.id;
     obj_context->gen_slice_data_size         = 0;
-    obj_context->vdp_bitstream_buffers_count = 0;
+    vector_clear(&obj_context->vdp_bitstream_buffers);
 
     switch (obj_context->vdp_codec) {
     case VDP_CODEC_MPEG1:
@@ -1273,12 +1549,26 @@ vdpau_EndPicture(
         default:
             break;
         }
-        for (i = 0; i < obj_context->vdp_bitstream_buffers_count; i++)
-            dump_VdpBitstreamBuffer(&obj_context->vdp_bitstream_buffers[i]);
+        for (i = 0; i < obj_context->vdp_bitstream_buffers.count; i++)
+            dump_VdpBitstreamBuffer(&obj_context->vdp_bitstream_buffers.data[i]);
     }
 
     VAStatus va_status;
     VdpStatus vdp_status;
+
+    /* Drop non-reference pictures if the display queue is backed up */
+    if (should_shed_picture(driver_data, obj_context)) {
+        D(bug("shed picture for surface 0x%08x\n", obj_surface->base.id));
+        obj_surface->is_shed = 1;
+        obj_surface->repeat_surface = obj_context->last_decoded_surface;
+        obj_surface->va_surface_status = VASurfaceSkipped;
+        obj_context->shed_pictures++;
+        obj_context->current_render_target = VA_INVALID_SURFACE;
+        destroy_dead_va_buffers(driver_data, obj_context);
+        return VA_STATUS_SUCCESS;
+    }
+    obj_context->decoded_pictures++;
+
     vdp_status = ensure_decoder_with_max_refs(
         driver_data,
         obj_context,
@@ -1290,11 +1580,32 @@ vdpau_EndPicture(
             obj_context->vdp_decoder,
             obj_surface->vdp_surface,
             (VdpPictureInfo)&obj_context->vdp_picture_info,
-            obj_context->vdp_bitstream_buffers_count,
-            obj_context->vdp_bitstream_buffers
+            obj_context->vdp_bitstream_buffers.count,
+            obj_context->vdp_bitstream_buffers.data
         );
     va_status = vdpau_get_VAStatus(vdp_status);
 
+    /* Read the picture back while the application waits for it */
+    if (vdp_status == VDP_STATUS_OK) {
+        obj_context->last_decoded_surface = obj_surface->base.id;
+        readahead_submit(obj_context->readahead, obj_surface->vdp_surface);
+    }
+
+#if USE_DEBUG
+    /* Report time to first frame, broken down by phase */
+    if (obj_context->decoded_pictures == 1 && obj_context->shed_pictures == 0) {
+        const uint64_t now = get_ticks_usec();
+        D(bug("context 0x%08x: first frame submitted after %llu us "
+              "(vaCreateContext %llu us, decoder creation %llu us, "
+              "first picture %llu us)\n",
+              obj_context->base.id,
+              (unsigned long long)(now - obj_context->create_ticks),
+              (unsigned long long)obj_context->create_usec,
+              (unsigned long long)obj_context->decoder_create_usec,
+              (unsigned long long)(now - obj_context->first_picture_ticks)));
+    }
+#endif
+
     /* XXX: assume we are done with rendering right away */
     obj_context->current_render_target = VA_INVALID_SURFACE;
 
@@ -47,6 +47,13 @@ check_decoder(
     VAEntrypoint         entrypoint
 ) attribute_hidden;
 
+// Creates the decoder ahead of the first picture (VDPAU_VIDEO_DECODER_EAGER)
+VAStatus
+warmup_decoder(
+    vdpau_driver_data_t *driver_data,
+    object_context_p     obj_context
+) attribute_hidden;
+
 // vaQueryConfigProfiles
 VAStatus
 vdpau_QueryConfigProfiles(
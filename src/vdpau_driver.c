@@ -28,6 +28,7 @@
 #include "vdpau_mixer.h"
 #include "vdpau_video.h"
 #include "vdpau_video_x11.h"
+#include "utils.h"
 #if USE_GLX
 #include "vdpau_video_glx.h"
 #include <va/va_backend_glx.h>
@@ -91,6 +92,128 @@ vdpau_get_VAStatus(VdpStatus vdp_status)
     return va_status;
 }
 
+// Release idle VDPAU resources held in driver caches
+void
+vdpau_evict_caches(vdpau_driver_data_t *driver_data)
+{
+    object_heap_iterator iter;
+    object_base_p obj;
+
+    /* This runs from VDPAU object creation, possibly on a thread that
+       already holds cache_lock, so eviction is skipped if it is busy */
+    if (pthread_mutex_trylock(&driver_data->cache_lock) != 0)
+        return;
+
+    /* RGBA images re-create their readback surface on next vaGetImage() */
+    obj = object_heap_first(&driver_data->image_heap, &iter);
+    while (obj) {
+        object_image_p const obj_image = (object_image_p)obj;
+        if (obj_image->vdp_rgba_output_surface != VDP_INVALID_HANDLE) {
+            vdpau_output_surface_destroy(driver_data,
+                                         obj_image->vdp_rgba_output_surface);
+            obj_image->vdp_rgba_output_surface = VDP_INVALID_HANDLE;
+        }
+        obj = object_heap_next(&driver_data->image_heap, &iter);
+    }
+
+    /* Drawables pre-bound but not presented to yet */
+    obj = object_heap_first(&driver_data->output_heap, &iter);
+    while (obj) {
+        object_output_p const obj_output = (object_output_p)obj;
+        obj = object_heap_next(&driver_data->output_heap, &iter);
+        if (obj_output->is_prebound)
+            output_surface_destroy(driver_data, obj_output);
+    }
+    pthread_mutex_unlock(&driver_data->cache_lock);
+}
+
+// Release unused object heap storage, returns the number of bytes released
+unsigned int
+vdpau_trim_memory(vdpau_driver_data_t *driver_data)
+{
+    unsigned int released = 0;
+
+    /* Contexts trim their own scratch storage, see vdpau_BeginPicture().
+       Only the object heaps are shared, and they have their own lock */
+    released += object_heap_trim(&driver_data->config_heap);
+    released += object_heap_trim(&driver_data->context_heap);
+    released += object_heap_trim(&driver_data->surface_heap);
+    released += object_heap_trim(&driver_data->buffer_heap);
+    released += object_heap_trim(&driver_data->output_heap);
+    released += object_heap_trim(&driver_data->image_heap);
+    released += object_heap_trim(&driver_data->subpicture_heap);
+    released += object_heap_trim(&driver_data->mixer_heap);
+#if USE_GLX
+    released += object_heap_trim(&driver_data->glx_surface_heap);
+#endif
+
+    D(bug("trimmed %u bytes of host memory\n", released));
+    return released;
+}
+
+// Report estimated host memory usage per subsystem
+void
+vdpau_host_memory_report(vdpau_driver_data_t *driver_data)
+{
+    object_heap_iterator iter;
+    object_base_p obj;
+    uint64_t heaps_size = 0, buffers_size = 0, scratch_size = 0;
+
+#define HEAP_SIZE(heap) \
+    ((uint64_t)driver_data->heap##_heap.heap_size * driver_data->heap##_heap.object_size)
+
+    heaps_size += HEAP_SIZE(config);
+    heaps_size += HEAP_SIZE(context);
+    heaps_size += HEAP_SIZE(surface);
+    heaps_size += HEAP_SIZE(buffer);
+    heaps_size += HEAP_SIZE(output);
+    heaps_size += HEAP_SIZE(image);
+    heaps_size += HEAP_SIZE(subpicture);
+    heaps_size += HEAP_SIZE(mixer);
+#if USE_GLX
+    heaps_size += HEAP_SIZE(glx_surface);
+#endif
+#undef HEAP_SIZE
+
+    obj = object_heap_first(&driver_data->buffer_heap, &iter);
+    while (obj) {
+        buffers_size += ((object_buffer_p)obj)->buffer_size;
+        obj = object_heap_next(&driver_data->buffer_heap, &iter);
+    }
+
+    obj = object_heap_first(&driver_data->context_heap, &iter);
+    while (obj) {
+        object_context_p const obj_context = (object_context_p)obj;
+        scratch_size += obj_context->gen_slice_data_size_max;
+        if (obj_context->vdp_bitstream_buffers.data !=
+            obj_context->vdp_bitstream_buffers.inline_data)
+            scratch_size += obj_context->vdp_bitstream_buffers.count_max *
+                sizeof(obj_context->vdp_bitstream_buffers.data[0]);
+        obj = object_heap_next(&driver_data->context_heap, &iter);
+    }
+
+    vdpau_information_message("Host memory: %llu KB used\n",
+                              (unsigned long long)((heaps_size + buffers_size + scratch_size) >> 10));
+    vdpau_information_message("  object heaps: %llu KB\n",
+                              (unsigned long long)(heaps_size >> 10));
+    vdpau_information_message("  VA buffers: %llu KB\n",
+                              (unsigned long long)(buffers_size >> 10));
+    vdpau_information_message("  decoder scratch: %llu KB\n",
+                              (unsigned long long)(scratch_size >> 10));
+}
+
+// Get whether memory usage is reported at vaTerminate() time
+static int
+get_memory_report_env(void)
+{
+    static int g_memory_report = -1;
+    if (g_memory_report < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_MEMORY_REPORT", &g_memory_report) < 0)
+            g_memory_report = 0;
+    }
+    return g_memory_report;
+}
+
 // Destroy BUFFER objects
 static void destroy_buffer_cb(object_base_p obj, void *user_data)
 {
@@ -156,6 +279,14 @@ destroy_heap(
 static void
 vdpau_common_Terminate(vdpau_driver_data_t *driver_data)
 {
+    if (driver_data->gpu_memory_budget || get_memory_report_env()) {
+        vdpau_gpu_memory_report(driver_data);
+        vdpau_host_memory_report(driver_data);
+    }
+
+    /* Show the last mosaic round before the outputs go away */
+    flush_surface_mosaics(driver_data, VA_INVALID_SURFACE);
+
     DESTROY_HEAP(buffer,      destroy_buffer_cb);
     DESTROY_HEAP(image,       NULL);
     DESTROY_HEAP(subpicture,  NULL);
@@ -167,6 +298,8 @@ vdpau_common_Terminate(vdpau_driver_data_t *driver_data)
 #if USE_GLX
     DESTROY_HEAP(glx_surface, NULL);
 #endif
+    pthread_mutex_destroy(&driver_data->cache_lock);
+    pthread_mutex_destroy(&driver_data->va_image_formats_lock);
 
     if (driver_data->vdp_device != VDP_INVALID_HANDLE) {
         vdpau_device_destroy(driver_data, driver_data->vdp_device);
@@ -249,6 +382,9 @@ vdpau_common_Initialize(vdpau_driver_data_t *driver_data)
         sprintf(&driver_data->va_vendor[len], ".pre%d", VDPAU_VIDEO_PRE_VERSION);
     }
 
+    pthread_mutex_init(&driver_data->cache_lock, NULL);
+    pthread_mutex_init(&driver_data->va_image_formats_lock, NULL);
+
     CREATE_HEAP(config,         CONFIG);
     CREATE_HEAP(context,        CONTEXT);
     CREATE_HEAP(surface,        SURFACE);
@@ -25,6 +25,8 @@
 #include "vaapi_compat.h"
 #include "vdpau_gate.h"
 #include "object_heap.h"
+#include "uvector.h"
+#include <pthread.h>
 
 
 #define VDPAU_DRIVER_DATA_INIT                           \
@@ -96,9 +98,19 @@ struct vdpau_driver_data {
     vdpau_vtable_t              vdp_vtable;
     VdpImplementation           vdp_impl_type;
     uint32_t                    vdp_impl_version;
+    pthread_mutex_t             gpu_memory_lock;       /* guards gpu_memory_usage and gpu_allocations */
+    uint64_t                    gpu_memory_usage[VDPAU_GPU_MEMORY_COUNT];
+    uint64_t                    gpu_memory_budget;
+    UVECTOR(VdpauGpuAllocation, 16) gpu_allocations;
+    pthread_mutex_t             cache_lock;            /* guards objects vdpau_evict_caches() may release */
+    unsigned int                prebound_outputs;
     VADisplayAttribute          va_display_attrs[VDPAU_MAX_DISPLAY_ATTRIBUTES];
     uint64_t                    va_display_attrs_mtime[VDPAU_MAX_DISPLAY_ATTRIBUTES];
     unsigned int                va_display_attrs_count;
+    pthread_mutex_t             va_image_formats_lock; /* guards the image formats probe */
+    VAImageFormat               va_image_formats[VDPAU_MAX_IMAGE_FORMATS];
+    unsigned int                va_image_formats_count;
+    unsigned int                va_image_formats_ready; /* probed, even if no format was found */
     char                        va_vendor[256];
 };
 
@@ -119,6 +131,21 @@ VdpBool
 vdpau_is_nvidia(vdpau_driver_data_t *driver_data, int *major, int *minor)
     attribute_hidden;
 
+// Release idle VDPAU resources held in driver caches
+void
+vdpau_evict_caches(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Release unused object heap storage, returns the number of bytes released
+unsigned int
+vdpau_trim_memory(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Report estimated host memory usage per subsystem
+void
+vdpau_host_memory_report(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
 // Translate VdpStatus to an appropriate VAStatus
 VAStatus
 vdpau_get_VAStatus(VdpStatus vdp_status)
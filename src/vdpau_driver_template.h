@@ -641,6 +641,10 @@ static VAStatus FUNC(Initialize)(VA_DRIVER_CONTEXT_P ctx)
     vtable->vaBufferInfo                    = vdpau_BufferInfo;
 #else
     vtable->vaBufferInfo                    = vdpau_BufferInfo_0_31_1;
+#endif
+#if VA_INIT_CHECK_VERSION(0,36,0)
+    vtable->vaAcquireBufferHandle           = vdpau_AcquireBufferHandle;
+    vtable->vaReleaseBufferHandle           = vdpau_ReleaseBufferHandle;
 #endif
     vtable->vaLockSurface                   = vdpau_LockSurface;
     vtable->vaUnlockSurface                 = vdpau_UnlockSurface;
@@ -21,6 +21,7 @@
 #include "sysdeps.h"
 #include "vdpau_gate.h"
 #include "vdpau_video.h"
+#include "utils.h"
 
 #define DEBUG 1
 #include "debug.h"
@@ -31,6 +32,9 @@ int vdpau_gate_init(vdpau_driver_data_t *driver_data)
 {
     VdpStatus vdp_status;
 
+    pthread_mutex_init(&driver_data->gpu_memory_lock, NULL);
+    vector_init(&driver_data->gpu_allocations);
+
 #define VDP_INIT_PROC(FUNC_ID, FUNC) do {                       \
         vdp_status = driver_data->vdp_get_proc_address          \
             (driver_data->vdp_device,                           \
@@ -104,6 +108,8 @@ int vdpau_gate_init(vdpau_driver_data_t *driver_data)
                   presentation_queue_get_background_color);
     VDP_INIT_PROC(PRESENTATION_QUEUE_DISPLAY,
                   presentation_queue_display);
+    VDP_INIT_PROC(PRESENTATION_QUEUE_GET_TIME,
+                  presentation_queue_get_time);
     VDP_INIT_PROC(PRESENTATION_QUEUE_BLOCK_UNTIL_SURFACE_IDLE,
                   presentation_queue_block_until_surface_idle);
     VDP_INIT_PROC(PRESENTATION_QUEUE_QUERY_SURFACE_STATUS,
@@ -132,12 +138,19 @@ int vdpau_gate_init(vdpau_driver_data_t *driver_data)
                   get_error_string);
 
 #undef VDP_INIT_PROC
+
+    int budget_mb;
+    if (getenv_int("VDPAU_VIDEO_GPU_BUDGET", &budget_mb) < 0 || budget_mb < 0)
+        budget_mb = 0;
+    driver_data->gpu_memory_budget = (uint64_t)budget_mb << 20;
     return 0;
 }
 
 // Deinitialize VDPAU hooks
 void vdpau_gate_exit(vdpau_driver_data_t *driver_data)
 {
+    vector_free(&driver_data->gpu_allocations);
+    pthread_mutex_destroy(&driver_data->gpu_memory_lock);
 }
 
 // Check VdpStatus
@@ -166,6 +179,180 @@ int vdpau_check_status(
     VDPAU_INVOKE_(VDP_STATUS_INVALID_POINTER,          \
                   func, __VA_ARGS__)
 
+static const char *gpu_memory_type_names[VDPAU_GPU_MEMORY_COUNT] = {
+    "video surfaces",
+    "output surfaces",
+    "bitmap surfaces",
+    "decoders"
+};
+
+// Return the total estimated GPU memory usage
+// NOTE: gpu_memory_lock must be held
+static uint64_t
+gpu_memory_total(vdpau_driver_data_p driver_data)
+{
+    uint64_t total = 0;
+    unsigned int i;
+
+    for (i = 0; i < VDPAU_GPU_MEMORY_COUNT; i++)
+        total += driver_data->gpu_memory_usage[i];
+    return total;
+}
+
+// Report estimated GPU memory usage per object type
+void vdpau_gpu_memory_report(vdpau_driver_data_p driver_data)
+{
+    uint64_t usage[VDPAU_GPU_MEMORY_COUNT], total;
+    unsigned int i;
+
+    pthread_mutex_lock(&driver_data->gpu_memory_lock);
+    for (i = 0; i < VDPAU_GPU_MEMORY_COUNT; i++)
+        usage[i] = driver_data->gpu_memory_usage[i];
+    total = gpu_memory_total(driver_data);
+    pthread_mutex_unlock(&driver_data->gpu_memory_lock);
+
+    vdpau_information_message("GPU memory: %llu KB used, %llu KB budget\n",
+                              (unsigned long long)(total >> 10),
+                              (unsigned long long)(driver_data->gpu_memory_budget >> 10));
+    for (i = 0; i < VDPAU_GPU_MEMORY_COUNT; i++)
+        vdpau_information_message("  %s: %llu KB\n", gpu_memory_type_names[i],
+                                  (unsigned long long)(usage[i] >> 10));
+}
+
+// Account for an allocation if it fits in the budget
+static int
+gpu_memory_try_reserve(
+    vdpau_driver_data_p driver_data,
+    VdpauGpuMemoryType  type,
+    uint64_t            size
+)
+{
+    const uint64_t budget = driver_data->gpu_memory_budget;
+    int fits;
+
+    pthread_mutex_lock(&driver_data->gpu_memory_lock);
+    fits = !budget || gpu_memory_total(driver_data) + size <= budget;
+    if (fits)
+        driver_data->gpu_memory_usage[type] += size;
+    pthread_mutex_unlock(&driver_data->gpu_memory_lock);
+    return fits;
+}
+
+// Account for a new allocation, evicting caches if the budget is exceeded
+static int
+gpu_memory_reserve(
+    vdpau_driver_data_p driver_data,
+    VdpauGpuMemoryType  type,
+    uint64_t            size
+)
+{
+    if (gpu_memory_try_reserve(driver_data, type, size))
+        return 1;
+
+    /* Caches release their objects through the destroy wrappers, which
+       take gpu_memory_lock, so eviction runs without holding it */
+    vdpau_evict_caches(driver_data);
+    if (gpu_memory_try_reserve(driver_data, type, size))
+        return 1;
+
+    vdpau_information_message("GPU memory budget exceeded, "
+                              "refusing %llu KB of %s\n",
+                              (unsigned long long)(size >> 10),
+                              gpu_memory_type_names[type]);
+    vdpau_gpu_memory_report(driver_data);
+    return 0;
+}
+
+// Release a reservation made by gpu_memory_reserve()
+static void
+gpu_memory_unreserve(
+    vdpau_driver_data_p driver_data,
+    VdpauGpuMemoryType  type,
+    uint64_t            size
+)
+{
+    pthread_mutex_lock(&driver_data->gpu_memory_lock);
+    ASSERT(driver_data->gpu_memory_usage[type] >= size);
+    driver_data->gpu_memory_usage[type] -= size;
+    pthread_mutex_unlock(&driver_data->gpu_memory_lock);
+}
+
+// Record the reserved size of a newly created VDPAU object
+static void
+gpu_memory_commit(
+    vdpau_driver_data_p driver_data,
+    VdpauGpuMemoryType  type,
+    uint32_t            handle,
+    uint64_t            size
+)
+{
+    VdpauGpuAllocation allocation;
+
+    allocation.handle = handle;
+    allocation.type   = type;
+    allocation.size   = size;
+
+    pthread_mutex_lock(&driver_data->gpu_memory_lock);
+    /* Without a record, the size could never be given back */
+    if (!vector_append(&driver_data->gpu_allocations, allocation))
+        driver_data->gpu_memory_usage[type] -= size;
+    pthread_mutex_unlock(&driver_data->gpu_memory_lock);
+}
+
+// Account for a destroyed VDPAU object, using the size it was created with
+static void
+gpu_memory_remove(
+    vdpau_driver_data_p driver_data,
+    VdpauGpuMemoryType  type,
+    uint32_t            handle
+)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&driver_data->gpu_memory_lock);
+    for (i = 0; i < driver_data->gpu_allocations.count; i++) {
+        const VdpauGpuAllocation * const allocation =
+            &driver_data->gpu_allocations.data[i];
+        if (allocation->handle == handle && allocation->type == type) {
+            ASSERT(driver_data->gpu_memory_usage[type] >= allocation->size);
+            driver_data->gpu_memory_usage[type] -= allocation->size;
+            vector_remove_fast(&driver_data->gpu_allocations, i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&driver_data->gpu_memory_lock);
+}
+
+// Estimate the size of a VdpVideoSurface
+static uint64_t
+get_video_surface_size(VdpChromaType chroma_type, uint32_t width, uint32_t height)
+{
+    const uint64_t luma_size = (uint64_t)((width + 15) & -16) * ((height + 15) & -16);
+
+    switch (chroma_type) {
+    case VDP_CHROMA_TYPE_422: return luma_size * 2;
+    case VDP_CHROMA_TYPE_444: return luma_size * 3;
+    }
+    return luma_size * 3 / 2;
+}
+
+// Estimate the size of a VdpOutputSurface or VdpBitmapSurface
+static uint64_t
+get_rgba_surface_size(VdpRGBAFormat rgba_format, uint32_t width, uint32_t height)
+{
+    const uint64_t size = (uint64_t)width * height;
+
+    return rgba_format == VDP_RGBA_FORMAT_A8 ? size : size * 4;
+}
+
+// Estimate the size of the internal VdpDecoder state
+static uint64_t
+get_decoder_size(uint32_t width, uint32_t height)
+{
+    /* Roughly one NV12 frame of intermediate and per-macroblock data */
+    return get_video_surface_size(VDP_CHROMA_TYPE_420, width, height);
+}
+
 // VdpGenerateCSCMatrix
 VdpStatus
 vdpau_generate_csc_matrix(
@@ -202,12 +389,23 @@ vdpau_video_surface_create(
     VdpVideoSurface     *surface
 )
 {
-    return VDPAU_INVOKE(video_surface_create,
-                        device,
-                        chroma_type,
-                        width,
-                        height,
-                        surface);
+    const uint64_t size = get_video_surface_size(chroma_type, width, height);
+    VdpStatus vdp_status;
+
+    if (!gpu_memory_reserve(driver_data, VDPAU_GPU_MEMORY_VIDEO_SURFACE, size))
+        return VDP_STATUS_RESOURCES;
+
+    vdp_status = VDPAU_INVOKE(video_surface_create,
+                              device,
+                              chroma_type,
+                              width,
+                              height,
+                              surface);
+    if (vdp_status == VDP_STATUS_OK)
+        gpu_memory_commit(driver_data, VDPAU_GPU_MEMORY_VIDEO_SURFACE, *surface, size);
+    else
+        gpu_memory_unreserve(driver_data, VDPAU_GPU_MEMORY_VIDEO_SURFACE, size);
+    return vdp_status;
 }
 
 // VdpVideoSurfaceDestroy
@@ -217,6 +415,8 @@ vdpau_video_surface_destroy(
     VdpVideoSurface      surface
 )
 {
+    gpu_memory_remove(driver_data, VDPAU_GPU_MEMORY_VIDEO_SURFACE, surface);
+
     return VDPAU_INVOKE(video_surface_destroy, surface);
 }
 
@@ -265,12 +465,23 @@ vdpau_output_surface_create(
     VdpOutputSurface    *surface
 )
 {
-    return VDPAU_INVOKE(output_surface_create,
-                        device,
-                        rgba_format,
-                        width,
-                        height,
-                        surface);
+    const uint64_t size = get_rgba_surface_size(rgba_format, width, height);
+    VdpStatus vdp_status;
+
+    if (!gpu_memory_reserve(driver_data, VDPAU_GPU_MEMORY_OUTPUT_SURFACE, size))
+        return VDP_STATUS_RESOURCES;
+
+    vdp_status = VDPAU_INVOKE(output_surface_create,
+                              device,
+                              rgba_format,
+                              width,
+                              height,
+                              surface);
+    if (vdp_status == VDP_STATUS_OK)
+        gpu_memory_commit(driver_data, VDPAU_GPU_MEMORY_OUTPUT_SURFACE, *surface, size);
+    else
+        gpu_memory_unreserve(driver_data, VDPAU_GPU_MEMORY_OUTPUT_SURFACE, size);
+    return vdp_status;
 }
 
 // VdpOutputSurfaceDestroy
@@ -280,6 +491,8 @@ vdpau_output_surface_destroy(
     VdpOutputSurface     surface
 )
 {
+    gpu_memory_remove(driver_data, VDPAU_GPU_MEMORY_OUTPUT_SURFACE, surface);
+
     return VDPAU_INVOKE(output_surface_destroy, surface);
 }
 
@@ -436,13 +649,24 @@ vdpau_bitmap_surface_create(
     VdpBitmapSurface    *surface
 )
 {
-    return VDPAU_INVOKE(bitmap_surface_create,
-                        device,
-                        rgba_format,
-                        width,
-                        height,
-                        frequently_accessed,
-                        surface);
+    const uint64_t size = get_rgba_surface_size(rgba_format, width, height);
+    VdpStatus vdp_status;
+
+    if (!gpu_memory_reserve(driver_data, VDPAU_GPU_MEMORY_BITMAP_SURFACE, size))
+        return VDP_STATUS_RESOURCES;
+
+    vdp_status = VDPAU_INVOKE(bitmap_surface_create,
+                              device,
+                              rgba_format,
+                              width,
+                              height,
+                              frequently_accessed,
+                              surface);
+    if (vdp_status == VDP_STATUS_OK)
+        gpu_memory_commit(driver_data, VDPAU_GPU_MEMORY_BITMAP_SURFACE, *surface, size);
+    else
+        gpu_memory_unreserve(driver_data, VDPAU_GPU_MEMORY_BITMAP_SURFACE, size);
+    return vdp_status;
 }
 
 // VdpBitmapSurfaceDestroy
@@ -452,6 +676,8 @@ vdpau_bitmap_surface_destroy(
     VdpBitmapSurface     surface
 )
 {
+    gpu_memory_remove(driver_data, VDPAU_GPU_MEMORY_BITMAP_SURFACE, surface);
+
     return VDPAU_INVOKE(bitmap_surface_destroy, surface);
 }
 
@@ -713,6 +939,19 @@ vdpau_presentation_queue_display(
                         earliest_presentation_time);
 }
 
+// VdpPresentationQueueGetTime
+VdpStatus
+vdpau_presentation_queue_get_time(
+    vdpau_driver_data_t *driver_data,
+    VdpPresentationQueue presentation_queue,
+    VdpTime             *current_time
+)
+{
+    return VDPAU_INVOKE(presentation_queue_get_time,
+                        presentation_queue,
+                        current_time);
+}
+
 // VdpPresentationQueueBlockUntilSurfaceIdle
 VdpStatus
 vdpau_presentation_queue_block_until_surface_idle(
@@ -783,13 +1022,24 @@ vdpau_decoder_create(
     VdpDecoder          *decoder
 )
 {
-    return VDPAU_INVOKE(decoder_create,
-                        device,
-                        profile,
-                        width,
-                        height,
-                        max_references,
-                        decoder);
+    const uint64_t size = get_decoder_size(width, height);
+    VdpStatus vdp_status;
+
+    if (!gpu_memory_reserve(driver_data, VDPAU_GPU_MEMORY_DECODER, size))
+        return VDP_STATUS_RESOURCES;
+
+    vdp_status = VDPAU_INVOKE(decoder_create,
+                              device,
+                              profile,
+                              width,
+                              height,
+                              max_references,
+                              decoder);
+    if (vdp_status == VDP_STATUS_OK)
+        gpu_memory_commit(driver_data, VDPAU_GPU_MEMORY_DECODER, *decoder, size);
+    else
+        gpu_memory_unreserve(driver_data, VDPAU_GPU_MEMORY_DECODER, size);
+    return vdp_status;
 }
 
 // VdpDecoderDestroy
@@ -799,6 +1049,8 @@ vdpau_decoder_destroy(
     VdpDecoder           decoder
 )
 {
+    gpu_memory_remove(driver_data, VDPAU_GPU_MEMORY_DECODER, decoder);
+
     return VDPAU_INVOKE(decoder_destroy, decoder);
 }
 
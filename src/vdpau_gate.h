@@ -62,6 +62,7 @@ struct vdpau_vtable {
     VdpPresentationQueueSetBackgroundColor *vdp_presentation_queue_set_background_color;
     VdpPresentationQueueGetBackgroundColor *vdp_presentation_queue_get_background_color;
     VdpPresentationQueueDisplay         *vdp_presentation_queue_display;
+    VdpPresentationQueueGetTime         *vdp_presentation_queue_get_time;
     VdpPresentationQueueBlockUntilSurfaceIdle *vdp_presentation_queue_block_until_surface_idle;
     VdpPresentationQueueQuerySurfaceStatus *vdp_presentation_queue_query_surface_status;
     VdpPresentationQueueTargetCreateX11 *vdp_presentation_queue_target_create_x11;
@@ -77,6 +78,22 @@ struct vdpau_vtable {
     VdpGetErrorString                   *vdp_get_error_string;
 };
 
+// GPU memory accounting categories
+typedef enum {
+    VDPAU_GPU_MEMORY_VIDEO_SURFACE = 0,
+    VDPAU_GPU_MEMORY_OUTPUT_SURFACE,
+    VDPAU_GPU_MEMORY_BITMAP_SURFACE,
+    VDPAU_GPU_MEMORY_DECODER,
+    VDPAU_GPU_MEMORY_COUNT
+} VdpauGpuMemoryType;
+
+// GPU memory accounted to a live VDPAU object
+typedef struct {
+    uint32_t            handle;
+    VdpauGpuMemoryType  type;
+    uint64_t            size;
+} VdpauGpuAllocation;
+
 // Initialize VDPAU hooks
 int vdpau_gate_init(vdpau_driver_data_p driver_data)
     attribute_hidden;
@@ -95,6 +112,10 @@ int vdpau_check_status(
 #define VDPAU_CHECK_STATUS(status, msg) \
     vdpau_check_status(driver_data, status, msg)
 
+// Report estimated GPU memory usage per object type
+void vdpau_gpu_memory_report(vdpau_driver_data_p driver_data)
+    attribute_hidden;
+
 // VdpGetApiVersion
 VdpStatus
 vdpau_get_api_version(vdpau_driver_data_p driver_data, uint32_t *api_version)
@@ -436,6 +457,14 @@ vdpau_presentation_queue_display(
     VdpTime              earliest_presentation_time
 ) attribute_hidden;
 
+// VdpPresentationQueueGetTime
+VdpStatus
+vdpau_presentation_queue_get_time(
+    vdpau_driver_data_p  driver_data,
+    VdpPresentationQueue presentation_queue,
+    VdpTime             *current_time
+) attribute_hidden;
+
 // VdpPresentationQueueBlockUntilSurfaceIdle
 VdpStatus
 vdpau_presentation_queue_block_until_surface_idle(
@@ -23,10 +23,15 @@
 #include "vdpau_video.h"
 #include "vdpau_buffer.h"
 #include "vdpau_mixer.h"
+#include "utils.h"
+#include <limits.h>
 
 #define DEBUG 1
 #include "debug.h"
 
+// Alignment of VA image planes and rows, in bytes (one cache line)
+#define IMAGE_ALIGN 64
+#define ALIGN_IMAGE(x) (((x) + IMAGE_ALIGN - 1) & ~(IMAGE_ALIGN - 1))
 
 // List of supported image formats
 typedef struct {
@@ -131,6 +136,368 @@ is_supported_format(
     return vdp_status == VDP_STATUS_OK && is_supported;
 }
 
+// Size of the surfaces used to measure image transfer throughput
+#define PROBE_WIDTH     1280
+#define PROBE_HEIGHT    720
+#define PROBE_LOOPS     4
+
+// Get whether image formats are listed by transfer throughput
+static int
+get_rank_formats_env(void)
+{
+    static int g_rank_formats = -1;
+    if (g_rank_formats < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_RANK_FORMATS", &g_rank_formats) < 0)
+            g_rank_formats = 0;
+    }
+    return g_rank_formats;
+}
+
+// Get whether image format probe results are cached on disk
+static int
+get_format_cache_env(void)
+{
+    static int g_format_cache = -1;
+    if (g_format_cache < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_FORMAT_CACHE", &g_format_cache) < 0)
+            g_format_cache = 0;
+    }
+    return g_format_cache;
+}
+
+// Get the file image format probe results are cached to
+static int
+get_format_cache_path(char *path, unsigned int size)
+{
+    const char *dir;
+    int len;
+
+    if ((dir = getenv("XDG_CACHE_HOME")) != NULL && *dir)
+        len = snprintf(path, size, "%s/vdpau-video-formats", dir);
+    else if ((dir = getenv("HOME")) != NULL && *dir)
+        len = snprintf(path, size, "%s/.cache/vdpau-video-formats", dir);
+    else
+        return -1;
+    return len > 0 && (unsigned int)len < size ? 0 : -1;
+}
+
+// Get the key identifying the probe results of this VDPAU implementation
+static void
+get_format_cache_key(vdpau_driver_data_t *driver_data, char *key, unsigned int size)
+{
+    const char *impl_string = NULL;
+    char *s;
+
+    if (vdpau_get_information_string(driver_data, &impl_string) != VDP_STATUS_OK ||
+        !impl_string)
+        impl_string = "unknown";
+
+    snprintf(key, size, "%d.%d.%d %dx%d %s",
+             VDPAU_VIDEO_MAJOR_VERSION,
+             VDPAU_VIDEO_MINOR_VERSION,
+             VDPAU_VIDEO_MICRO_VERSION,
+             PROBE_WIDTH, PROBE_HEIGHT,
+             impl_string);
+
+    /* Keep the key on a single line */
+    for (s = key; *s; s++) {
+        if (*s == '\n' || *s == '\r')
+            *s = ' ';
+    }
+}
+
+// Load image format probe results, returns the number of formats or -1
+static int
+load_format_cache(
+    vdpau_driver_data_t *driver_data,
+    unsigned int        *formats,
+    unsigned int        *costs
+)
+{
+    char path[1024], key[256], line[512];
+    unsigned int index, cost;
+    int n = -1;
+    FILE *fp;
+
+    if (get_format_cache_path(path, sizeof(path)) < 0)
+        return -1;
+    if ((fp = fopen(path, "r")) == NULL)
+        return -1;
+
+    get_format_cache_key(driver_data, key, sizeof(key));
+    if (fgets(line, sizeof(line), fp) && line[0] == '#' &&
+        strncmp(&line[2], key, strlen(key)) == 0 &&
+        line[2 + strlen(key)] == '\n') {
+        n = 0;
+        while (n < VDPAU_MAX_IMAGE_FORMATS && fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "%u %u", &index, &cost) != 2 ||
+                index >= ARRAY_ELEMS(vdpau_image_formats_map)) {
+                n = -1;
+                break;
+            }
+            formats[n] = index;
+            costs[n]   = cost;
+            n++;
+        }
+    }
+    fclose(fp);
+    return n;
+}
+
+// Save image format probe results
+static void
+save_format_cache(
+    vdpau_driver_data_t *driver_data,
+    const unsigned int  *formats,
+    const unsigned int  *costs,
+    unsigned int         num_formats
+)
+{
+    char path[1024], key[256];
+    unsigned int i;
+    FILE *fp;
+
+    if (get_format_cache_path(path, sizeof(path)) < 0)
+        return;
+    if ((fp = fopen(path, "w")) == NULL)
+        return;
+
+    get_format_cache_key(driver_data, key, sizeof(key));
+    fprintf(fp, "# %s\n", key);
+    for (i = 0; i < num_formats; i++)
+        fprintf(fp, "%u %u\n", formats[i], costs[i]);
+    fclose(fp);
+}
+
+// Measure the time to upload and read back an image, in microseconds
+static unsigned int
+probe_format_cost(
+    vdpau_driver_data_t            *driver_data,
+    const vdpau_image_format_map_t *m,
+    uint8_t                        *buffer
+)
+{
+    const unsigned int w = PROBE_WIDTH, h = PROBE_HEIGHT;
+    VdpVideoSurface vdp_surface = VDP_INVALID_HANDLE;
+    VdpOutputSurface vdp_output_surface = VDP_INVALID_HANDLE;
+    VdpStatus vdp_status;
+    uint8_t *planes[3];
+    uint32_t pitches[3];
+    uint64_t start_ticks = 0;
+    unsigned int i;
+
+    switch (m->vdp_format_type) {
+    case VDP_IMAGE_FORMAT_TYPE_YCBCR:
+        vdp_status = vdpau_video_surface_create(
+            driver_data,
+            driver_data->vdp_device,
+            VDP_CHROMA_TYPE_420,
+            w, h,
+            &vdp_surface
+        );
+        if (vdp_status != VDP_STATUS_OK)
+            return UINT_MAX;
+
+        planes[0]  = buffer;
+        pitches[0] = w;
+        switch (m->vdp_format) {
+        case VDP_YCBCR_FORMAT_NV12:
+            planes[1]  = planes[0] + w * h;
+            pitches[1] = w;
+            break;
+        case VDP_YCBCR_FORMAT_YV12:
+            planes[1]  = planes[0] + w * h;
+            planes[2]  = planes[1] + (w / 2) * (h / 2);
+            pitches[1] = w / 2;
+            pitches[2] = w / 2;
+            break;
+        case VDP_YCBCR_FORMAT_UYVY:
+        case VDP_YCBCR_FORMAT_YUYV:
+            pitches[0] = 2 * w;
+            break;
+        default:
+            pitches[0] = 4 * w;
+            break;
+        }
+
+        /* The first transfer is a warm-up, not timed */
+        for (i = 0; i <= PROBE_LOOPS; i++) {
+            if (i == 1)
+                start_ticks = get_ticks_usec();
+            vdp_status = vdpau_video_surface_put_bits_ycbcr(
+                driver_data,
+                vdp_surface,
+                m->vdp_format,
+                planes, pitches
+            );
+            if (vdp_status != VDP_STATUS_OK)
+                break;
+            vdp_status = vdpau_video_surface_get_bits_ycbcr(
+                driver_data,
+                vdp_surface,
+                m->vdp_format,
+                planes, pitches
+            );
+            if (vdp_status != VDP_STATUS_OK)
+                break;
+        }
+        vdpau_video_surface_destroy(driver_data, vdp_surface);
+        break;
+    case VDP_IMAGE_FORMAT_TYPE_RGBA:
+        vdp_status = vdpau_output_surface_create(
+            driver_data,
+            driver_data->vdp_device,
+            m->vdp_format,
+            w, h,
+            &vdp_output_surface
+        );
+        if (vdp_status != VDP_STATUS_OK)
+            return UINT_MAX;
+
+        planes[0]  = buffer;
+        pitches[0] = 4 * w;
+        for (i = 0; i <= PROBE_LOOPS; i++) {
+            if (i == 1)
+                start_ticks = get_ticks_usec();
+            vdp_status = vdpau_output_surface_put_bits_native(
+                driver_data,
+                vdp_output_surface,
+                (const uint8_t **)planes, pitches,
+                NULL
+            );
+            if (vdp_status != VDP_STATUS_OK)
+                break;
+            vdp_status = vdpau_output_surface_get_bits_native(
+                driver_data,
+                vdp_output_surface,
+                NULL,
+                planes, pitches
+            );
+            if (vdp_status != VDP_STATUS_OK)
+                break;
+        }
+        vdpau_output_surface_destroy(driver_data, vdp_output_surface);
+        break;
+    default:
+        return UINT_MAX;
+    }
+    if (vdp_status != VDP_STATUS_OK)
+        return UINT_MAX;
+    return (get_ticks_usec() - start_ticks) / PROBE_LOOPS;
+}
+
+// Get the rank of an image format type, in image formats map order
+static unsigned int
+get_format_type_rank(VdpImageFormatType type)
+{
+    unsigned int i;
+    for (i = 0; i < ARRAY_ELEMS(vdpau_image_formats_map); i++) {
+        if (vdpau_image_formats_map[i].vdp_format_type == type)
+            break;
+    }
+    return i;
+}
+
+// Probe supported image formats, returns the number of formats
+static unsigned int
+probe_formats(
+    vdpau_driver_data_t *driver_data,
+    unsigned int        *formats,
+    unsigned int        *costs
+)
+{
+    const int rank_formats = get_rank_formats_env();
+    uint8_t *buffer = NULL;
+    unsigned int i, j, n = 0;
+
+    if (rank_formats) {
+        buffer = malloc(4 * PROBE_WIDTH * PROBE_HEIGHT);
+        if (buffer)
+            memset(buffer, 0x80, 4 * PROBE_WIDTH * PROBE_HEIGHT);
+    }
+
+    for (i = 0; i < ARRAY_ELEMS(vdpau_image_formats_map); i++) {
+        const vdpau_image_format_map_t * const m = &vdpau_image_formats_map[i];
+        if (!is_supported_format(driver_data, m->vdp_format_type, m->vdp_format))
+            continue;
+
+        /* If the assert fails then VDPAU_MAX_IMAGE_FORMATS needs to be bigger */
+        ASSERT(n < VDPAU_MAX_IMAGE_FORMATS);
+        if (n >= VDPAU_MAX_IMAGE_FORMATS)
+            break;
+
+        /* Formats sharing a VDPAU format (e.g. YV12 and I420) cost the same */
+        costs[n] = 0;
+        if (buffer) {
+            for (j = 0; j < n; j++) {
+                const vdpau_image_format_map_t * const m2 =
+                    &vdpau_image_formats_map[formats[j]];
+                if (m2->vdp_format_type == m->vdp_format_type &&
+                    m2->vdp_format == m->vdp_format)
+                    break;
+            }
+            costs[n] = j < n ? costs[j] : probe_format_cost(driver_data, m, buffer);
+            D(bug("image format %.4s: %u us per upload and readback\n",
+                  (const char *)&m->va_format.fourcc, costs[n]));
+        }
+        formats[n++] = i;
+    }
+    free(buffer);
+    return n;
+}
+
+// Ensure the list of supported image formats is ready, cheapest transfers first
+static void
+ensure_image_formats(vdpau_driver_data_t *driver_data)
+{
+    unsigned int formats[VDPAU_MAX_IMAGE_FORMATS];
+    unsigned int costs[VDPAU_MAX_IMAGE_FORMATS];
+    unsigned int i, j, n;
+    int num_formats = -1;
+
+    /* Concurrent vaQueryImageFormats() calls probe once. A probe that
+       found no format is not repeated either */
+    pthread_mutex_lock(&driver_data->va_image_formats_lock);
+    if (driver_data->va_image_formats_ready) {
+        pthread_mutex_unlock(&driver_data->va_image_formats_lock);
+        return;
+    }
+
+    if (get_rank_formats_env() && get_format_cache_env())
+        num_formats = load_format_cache(driver_data, formats, costs);
+    if (num_formats <= 0) {
+        num_formats = probe_formats(driver_data, formats, costs);
+        if (get_rank_formats_env() && get_format_cache_env())
+            save_format_cache(driver_data, formats, costs, num_formats);
+    }
+    n = num_formats;
+
+    /* Stable sort by cost, YCbCr formats are still listed before RGBA
+       ones since their readback is measured from video surfaces */
+    for (i = 1; i < n; i++) {
+        const unsigned int format = formats[i], cost = costs[i];
+        const unsigned int rank = get_format_type_rank(
+            vdpau_image_formats_map[format].vdp_format_type);
+        for (j = i; j > 0; j--) {
+            const unsigned int prev_rank = get_format_type_rank(
+                vdpau_image_formats_map[formats[j - 1]].vdp_format_type);
+            if (prev_rank < rank || (prev_rank == rank && costs[j - 1] <= cost))
+                break;
+            formats[j] = formats[j - 1];
+            costs[j]   = costs[j - 1];
+        }
+        formats[j] = format;
+        costs[j]   = cost;
+    }
+
+    for (i = 0; i < n; i++)
+        driver_data->va_image_formats[i] =
+            vdpau_image_formats_map[formats[i]].va_format;
+    driver_data->va_image_formats_count = n;
+    driver_data->va_image_formats_ready = 1;
+    pthread_mutex_unlock(&driver_data->va_image_formats_lock);
+}
+
 // vaQueryImageFormats
 VAStatus
 vdpau_QueryImageFormats(
@@ -147,15 +514,13 @@ vdpau_QueryImageFormats(
     if (format_list == NULL)
         return VA_STATUS_SUCCESS;
 
-    int i, n = 0;
-    for (i = 0; i < ARRAY_ELEMS(vdpau_image_formats_map); i++) {
-        const vdpau_image_format_map_t * const f = &vdpau_image_formats_map[i];
-        if (is_supported_format(driver_data, f->vdp_format_type, f->vdp_format))
-            format_list[n++] = f->va_format;
-    }
+    /* Supported formats are probed once, then listed from the cache */
+    ensure_image_formats(driver_data);
+
+    unsigned int i, n = driver_data->va_image_formats_count;
+    for (i = 0; i < n; i++)
+        format_list[i] = driver_data->va_image_formats[i];
 
-    /* If the assert fails then VDPAU_MAX_IMAGE_FORMATS needs to be bigger */
-    ASSERT(n <= VDPAU_MAX_IMAGE_FORMATS);
     if (num_formats)
         *num_formats = n;
 
@@ -175,7 +540,7 @@ vdpau_CreateImage(
     VDPAU_DRIVER_DATA_INIT;
 
     VAStatus va_status = VA_STATUS_ERROR_OPERATION_FAILED;
-    unsigned int i, width2, height2, size2, size;
+    unsigned int i, width2, height2, pitch, pitch2;
 
     if (!format || !out_image)
         return VA_STATUS_ERROR_INVALID_PARAMETER;
@@ -205,30 +570,31 @@ vdpau_CreateImage(
     image->image_id       = image_id;
     image->buf            = VA_INVALID_ID;
 
-    size    = width * height;
+    /* Align every plane and every row to cache line boundaries */
     width2  = (width  + 1) / 2;
     height2 = (height + 1) / 2;
-    size2   = width2 * height2;
+    pitch   = ALIGN_IMAGE(width);
 
     switch (format->fourcc) {
     case VA_FOURCC('N','V','1','2'):
         image->num_planes = 2;
-        image->pitches[0] = width;
+        image->pitches[0] = pitch;
         image->offsets[0] = 0;
-        image->pitches[1] = width;
-        image->offsets[1] = size;
-        image->data_size  = size + 2 * size2;
+        image->pitches[1] = ALIGN_IMAGE(width2 * 2);
+        image->offsets[1] = pitch * height;
+        image->data_size  = image->offsets[1] + image->pitches[1] * height2;
         break;
     case VA_FOURCC('Y','V','1','2'):
     case VA_FOURCC('I','4','2','0'):
+        pitch2            = ALIGN_IMAGE(width2);
         image->num_planes = 3;
-        image->pitches[0] = width;
+        image->pitches[0] = pitch;
         image->offsets[0] = 0;
-        image->pitches[1] = width2;
-        image->offsets[1] = size;
-        image->pitches[2] = width2;
-        image->offsets[2] = size + size2;
-        image->data_size  = size + 2 * size2;
+        image->pitches[1] = pitch2;
+        image->offsets[1] = pitch * height;
+        image->pitches[2] = pitch2;
+        image->offsets[2] = image->offsets[1] + pitch2 * height2;
+        image->data_size  = image->offsets[2] + pitch2 * height2;
         break;
     case VA_FOURCC('A','R','G','B'):
     case VA_FOURCC('A','B','G','R'):
@@ -237,21 +603,21 @@ vdpau_CreateImage(
     case VA_FOURCC('U','Y','V','Y'):
     case VA_FOURCC('Y','U','Y','V'):
         image->num_planes = 1;
-        image->pitches[0] = width * 4;
+        image->pitches[0] = ALIGN_IMAGE(width * 4);
         image->offsets[0] = 0;
         image->data_size  = image->offsets[0] + image->pitches[0] * height;
         break;
     case VA_FOURCC('I','A','4','4'):
     case VA_FOURCC('A','I','4','4'):
         image->num_planes = 1;
-        image->pitches[0] = width;
+        image->pitches[0] = pitch;
         image->offsets[0] = 0;
         image->data_size  = image->offsets[0] + image->pitches[0] * height;
         break;
     case VA_FOURCC('I','A','8','8'):
     case VA_FOURCC('A','I','8','8'):
         image->num_planes = 1;
-        image->pitches[0] = width * 2;
+        image->pitches[0] = ALIGN_IMAGE(width * 2);
         image->offsets[0] = 0;
         image->data_size  = image->offsets[0] + image->pitches[0] * height;
         break;
@@ -259,12 +625,9 @@ vdpau_CreateImage(
         goto error;
     }
 
-    /* Allocate more bytes to align image data base on 16-byte boundaries */
-    /* XXX: align other planes too? */
-    static const int ALIGN = 16;
-
+    /* Allocate more bytes to align image data base on 64-byte boundaries */
     va_status = vdpau_CreateBuffer(ctx, 0, VAImageBufferType,
-                                   image->data_size + ALIGN, 1, NULL,
+                                   image->data_size + IMAGE_ALIGN, 1, NULL,
                                    &image->buf);
     if (va_status != VA_STATUS_SUCCESS)
         goto error;
@@ -273,9 +636,9 @@ vdpau_CreateImage(
     if (!obj_buffer)
         goto error;
 
-    int align = ((uintptr_t)obj_buffer->buffer_data) % ALIGN;
+    int align = ((uintptr_t)obj_buffer->buffer_data) % IMAGE_ALIGN;
     if (align) {
-        align = ALIGN - align;
+        align = IMAGE_ALIGN - align;
         for (i = 0; i < image->num_planes; i++)
             image->offsets[i] += align;
     }
@@ -317,9 +680,13 @@ vdpau_DestroyImage(
     if (!obj_image)
         return VA_STATUS_ERROR_INVALID_IMAGE;
 
-    if (obj_image->vdp_rgba_output_surface != VDP_INVALID_HANDLE)
+    pthread_mutex_lock(&driver_data->cache_lock);
+    if (obj_image->vdp_rgba_output_surface != VDP_INVALID_HANDLE) {
         vdpau_output_surface_destroy(driver_data,
                                      obj_image->vdp_rgba_output_surface);
+        obj_image->vdp_rgba_output_surface = VDP_INVALID_HANDLE;
+    }
+    pthread_mutex_unlock(&driver_data->cache_lock);
 
     if (obj_image->vdp_palette) {
         free(obj_image->vdp_palette);
@@ -402,6 +769,14 @@ get_image(
     unsigned int src_stride[3];
     int i;
 
+    /* The picture was shed by vaEndPicture() and the surface holds stale
+       data, so the previous picture of the stream is read back instead */
+    if (obj_surface->is_shed) {
+        obj_surface = VDPAU_SURFACE(obj_surface->repeat_surface);
+        if (!obj_surface || obj_surface->is_shed)
+            return VA_STATUS_ERROR_OPERATION_FAILED;
+    }
+
     object_buffer_p obj_buffer = VDPAU_BUFFER(image->buf);
     if (!obj_buffer)
         return VA_STATUS_ERROR_INVALID_BUFFER;
@@ -432,6 +807,31 @@ get_image(
             obj_surface->height != rect->height)
             return VA_STATUS_ERROR_OPERATION_FAILED;
 
+        /* The picture may have been read back right after decoding. The
+           next pictures are read back into the layout of this image */
+        object_context_p obj_context = VDPAU_CONTEXT(obj_surface->va_context);
+        if (obj_context && obj_context->readahead) {
+            vdpau_readahead_layout_t layout;
+            memset(&layout, 0, sizeof(layout));
+            layout.vdp_format = obj_image->vdp_format;
+            layout.num_planes = image->num_planes;
+            for (i = 0; i < image->num_planes; i++) {
+                layout.offsets[i] = src[i] - (uint8_t *)obj_buffer->buffer_data;
+                layout.pitches[i] = src_stride[i];
+            }
+            layout.data_size  = obj_buffer->buffer_size;
+            layout.align      = IMAGE_ALIGN;
+            readahead_set_layout(obj_context->readahead, &layout);
+
+            if (readahead_fetch(obj_context->readahead,
+                                obj_surface->vdp_surface,
+                                &layout,
+                                &obj_buffer->buffer_data,
+                                (obj_buffer->shared_fd < 0 &&
+                                 obj_buffer->map_count == 0)))
+                return VA_STATUS_SUCCESS;
+        }
+
         vdp_status = vdpau_video_surface_get_bits_ycbcr(
             driver_data,
             obj_surface->vdp_surface,
@@ -441,17 +841,27 @@ get_image(
         break;
     }
     case VDP_IMAGE_FORMAT_TYPE_RGBA: {
-        if (obj_image->vdp_rgba_output_surface == VA_INVALID_ID) {
+        /* The readback surface may be released by vdpau_evict_caches().
+           Creating it may evict caches too, so cache_lock is not held */
+        VdpOutputSurface vdp_output_surface = VDP_INVALID_HANDLE;
+        pthread_mutex_lock(&driver_data->cache_lock);
+        if (obj_image->vdp_rgba_output_surface == VDP_INVALID_HANDLE) {
+            pthread_mutex_unlock(&driver_data->cache_lock);
             vdp_status = vdpau_output_surface_create(
                 driver_data,
                 driver_data->vdp_device,
                 obj_image->vdp_format,
                 obj_image->image.width,
                 obj_image->image.height,
-                &obj_image->vdp_rgba_output_surface
+                &vdp_output_surface
             );
             if (vdp_status != VDP_STATUS_OK)
                 return vdpau_get_VAStatus(vdp_status);
+            pthread_mutex_lock(&driver_data->cache_lock);
+            if (obj_image->vdp_rgba_output_surface == VDP_INVALID_HANDLE) {
+                obj_image->vdp_rgba_output_surface = vdp_output_surface;
+                vdp_output_surface = VDP_INVALID_HANDLE;
+            }
         }
 
         VdpRect vdp_rect;
@@ -469,15 +879,18 @@ get_image(
             &vdp_rect,
             0
         );
-        if (vdp_status != VDP_STATUS_OK)
-            return vdpau_get_VAStatus(vdp_status);
+        if (vdp_status == VDP_STATUS_OK)
+            vdp_status = vdpau_output_surface_get_bits_native(
+                driver_data,
+                obj_image->vdp_rgba_output_surface,
+                &vdp_rect,
+                src, src_stride
+            );
+        pthread_mutex_unlock(&driver_data->cache_lock);
 
-        vdp_status = vdpau_output_surface_get_bits_native(
-            driver_data,
-            obj_image->vdp_rgba_output_surface,
-            &vdp_rect,
-            src, src_stride
-        );
+        /* Another thread installed a readback surface meanwhile */
+        if (vdp_output_surface != VDP_INVALID_HANDLE)
+            vdpau_output_surface_destroy(driver_data, vdp_output_surface);
         break;
     }
     default:
@@ -583,12 +996,26 @@ put_image(
     if (obj_image->vdp_format_type != VDP_IMAGE_FORMAT_TYPE_YCBCR)
         return VA_STATUS_ERROR_OPERATION_FAILED;
 
+    object_context_p obj_context = VDPAU_CONTEXT(obj_surface->va_context);
+    if (obj_context)
+        readahead_cancel(obj_context->readahead, obj_surface->vdp_surface);
+
     vdp_status = vdpau_video_surface_put_bits_ycbcr(
         driver_data,
         obj_surface->vdp_surface,
         obj_image->vdp_format,
         src, src_stride
     );
+    if (vdp_status == VDP_STATUS_OK) {
+        obj_surface->mirror_output_id = VA_INVALID_ID;
+        obj_surface->update_count++;
+
+        /* The surface now holds a complete picture again */
+        if (obj_surface->is_shed) {
+            obj_surface->is_shed = 0;
+            obj_surface->va_surface_status = VASurfaceReady;
+        }
+    }
     return vdpau_get_VAStatus(vdp_status);
 }
 
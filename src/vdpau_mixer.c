@@ -23,6 +23,9 @@
 #include "vdpau_video.h"
 #include <math.h>
 
+#define DEBUG 1
+#include "debug.h"
+
 #define VDPAU_MAX_VIDEO_MIXER_PARAMS    4
 #define VDPAU_MAX_VIDEO_MIXER_FEATURES  20
 
@@ -88,7 +91,10 @@ video_mixer_create(
     obj_mixer->vdp_procamp_mtime = 0;
     obj_mixer->vdp_bgcolor_mtime = 0;
     obj_mixer->hqscaling_level   = 0;
-    obj_mixer->va_scale          = 0;
+    obj_mixer->hqscaling_levels  = 0;
+    obj_mixer->hqscaling_active  = 0;
+    obj_mixer->hqscaling_dst_width  = 0;
+    obj_mixer->hqscaling_dst_height = 0;
 
     VdpProcamp * const procamp   = &obj_mixer->vdp_procamp;
     procamp->struct_version      = VDP_PROCAMP_VERSION;
@@ -114,8 +120,10 @@ video_mixer_create(
         if (video_mixer_has_feature(driver_data, feature)) {
             features[n_features++] = feature;
             obj_mixer->hqscaling_level = i;
+            obj_mixer->hqscaling_levels |= 1U << i;
         }
     }
+    obj_mixer->hqscaling_governed = obj_mixer->hqscaling_level;
 
     video_mixer_init_deint_surfaces(obj_mixer);
 
@@ -327,36 +335,114 @@ video_mixer_update_background_color(
     return VDP_STATUS_OK;
 }
 
+/* Frames presented late in a row before the HQ scaling level is lowered */
+#define HQSCALING_MAX_LATE_FRAMES       3
+/* Frames presented on time before a higher level is tried again */
+#define HQSCALING_MIN_PROBE_FRAMES      300
+#define HQSCALING_MAX_PROBE_FRAMES      (HQSCALING_MIN_PROBE_FRAMES << 4)
+
+// Reset the HQ scaling governor, e.g. when the output size changed
+static void
+video_mixer_hqscaling_reset(object_mixer_p obj_mixer)
+{
+    obj_mixer->hqscaling_governed      = obj_mixer->hqscaling_level;
+    obj_mixer->hqscaling_late_frames   = 0;
+    obj_mixer->hqscaling_ontime_frames = 0;
+    obj_mixer->hqscaling_probe_frames  = HQSCALING_MIN_PROBE_FRAMES;
+}
+
+// Step the HQ scaling level down when frames are late, and back up when they are not
+void
+video_mixer_hqscaling_feedback(
+    object_mixer_p       obj_mixer,
+    int                  is_late
+)
+{
+    unsigned int level = obj_mixer->hqscaling_governed;
+
+    if (!obj_mixer->hqscaling_active)
+        return;
+
+    if (is_late) {
+        obj_mixer->hqscaling_ontime_frames = 0;
+        if (++obj_mixer->hqscaling_late_frames < HQSCALING_MAX_LATE_FRAMES)
+            return;
+        obj_mixer->hqscaling_late_frames = 0;
+        while (--level > 0 && !(obj_mixer->hqscaling_levels & (1U << level)))
+            ;
+        if (level == 0)
+            return;
+
+        /* Back off before probing the level that just failed again */
+        if (obj_mixer->hqscaling_probe_frames < HQSCALING_MAX_PROBE_FRAMES)
+            obj_mixer->hqscaling_probe_frames *= 2;
+    }
+    else {
+        obj_mixer->hqscaling_late_frames = 0;
+        if (++obj_mixer->hqscaling_ontime_frames < obj_mixer->hqscaling_probe_frames)
+            return;
+        obj_mixer->hqscaling_ontime_frames = 0;
+        while (++level <= obj_mixer->hqscaling_level &&
+               !(obj_mixer->hqscaling_levels & (1U << level)))
+            ;
+        if (level > obj_mixer->hqscaling_level)
+            return;
+    }
+    D(bug("HQ scaling level %u -> %u\n", obj_mixer->hqscaling_governed, level));
+    obj_mixer->hqscaling_governed = level;
+}
+
 static VdpStatus
 video_mixer_update_scaling(
     vdpau_driver_data_t *driver_data,
     object_mixer_p       obj_mixer,
-    unsigned int         va_scale
+    unsigned int         va_scale,
+    const VdpRect       *vdp_dst_rect
 )
 {
-    if (obj_mixer->va_scale == va_scale)
-        return VDP_STATUS_OK;
+    const unsigned int dst_width  = vdp_dst_rect->x1 - vdp_dst_rect->x0;
+    const unsigned int dst_height = vdp_dst_rect->y1 - vdp_dst_rect->y0;
+
+    /* The sustainable level depends on the amount of scaling */
+    if (obj_mixer->hqscaling_dst_width  != dst_width ||
+        obj_mixer->hqscaling_dst_height != dst_height) {
+        obj_mixer->hqscaling_dst_width  = dst_width;
+        obj_mixer->hqscaling_dst_height = dst_height;
+        video_mixer_hqscaling_reset(obj_mixer);
+    }
 
     /* Only HQ scaling is supported, other flags disable HQ scaling */
-    if (obj_mixer->hqscaling_level >= 1) {
-        VdpVideoMixerFeature features[1];
-        VdpBool feature_enables[1];
-        features[0] = VDP_VIDEO_MIXER_FEATURE_HIGH_QUALITY_SCALING_L1;
-        feature_enables[0] = (va_scale == VA_FILTER_SCALING_HQ ?
-                              VDP_TRUE : VDP_FALSE);
+    const unsigned int level = (va_scale == VA_FILTER_SCALING_HQ ?
+                                obj_mixer->hqscaling_governed : 0);
+    if (obj_mixer->hqscaling_active == level)
+        return VDP_STATUS_OK;
 
-        VdpStatus vdp_status;
-        vdp_status = vdpau_video_mixer_set_feature_enables(
-            driver_data,
-            obj_mixer->vdp_video_mixer,
-            1,
-            features,
-            feature_enables
-        );
-        if (!VDPAU_CHECK_STATUS(vdp_status, "VdpVideoMixerSetFeatureEnables()"))
-            return vdp_status;
+    VdpVideoMixerFeature features[2];
+    VdpBool feature_enables[2];
+    unsigned int n_features = 0;
+    if (obj_mixer->hqscaling_active) {
+        features[n_features] = VDP_VIDEO_MIXER_FEATURE_HIGH_QUALITY_SCALING_L1 +
+            obj_mixer->hqscaling_active - 1;
+        feature_enables[n_features++] = VDP_FALSE;
+    }
+    if (level) {
+        features[n_features] = VDP_VIDEO_MIXER_FEATURE_HIGH_QUALITY_SCALING_L1 +
+            level - 1;
+        feature_enables[n_features++] = VDP_TRUE;
     }
-    obj_mixer->va_scale = va_scale;
+
+    VdpStatus vdp_status;
+    vdp_status = vdpau_video_mixer_set_feature_enables(
+        driver_data,
+        obj_mixer->vdp_video_mixer,
+        n_features,
+        features,
+        feature_enables
+    );
+    if (!VDPAU_CHECK_STATUS(vdp_status, "VdpVideoMixerSetFeatureEnables()"))
+        return vdp_status;
+
+    obj_mixer->hqscaling_active = level;
     return VDP_STATUS_OK;
 }
 
@@ -406,7 +492,8 @@ video_mixer_render(
         return vdp_status;
 
     const unsigned int va_scale = flags & VA_FILTER_SCALING_MASK;
-    vdp_status = video_mixer_update_scaling(driver_data, obj_mixer, va_scale);
+    vdp_status = video_mixer_update_scaling(driver_data, obj_mixer, va_scale,
+                                            vdp_dst_rect);
     if (vdp_status != VDP_STATUS_OK)
         return vdp_status;
 
@@ -437,7 +524,7 @@ video_mixer_render(
         0, NULL,
         vdp_src_rect,
         vdp_output_surface,
-        NULL,
+        vdp_dst_rect,
         vdp_dst_rect,
         0, NULL
     );
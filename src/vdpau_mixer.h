@@ -33,8 +33,15 @@ struct object_mixer {
     VdpChromaType               vdp_chroma_type;
     unsigned int                width;
     unsigned int                height;
-    unsigned int                hqscaling_level;
-    unsigned int                va_scale;
+    unsigned int                hqscaling_level;        /* highest supported HQ scaling level */
+    unsigned int                hqscaling_levels;       /* mask of supported HQ scaling levels */
+    unsigned int                hqscaling_active;       /* level enabled in the mixer, 0 if none */
+    unsigned int                hqscaling_governed;     /* level the GPU sustains at the current size */
+    unsigned int                hqscaling_dst_width;
+    unsigned int                hqscaling_dst_height;
+    unsigned int                hqscaling_late_frames;
+    unsigned int                hqscaling_ontime_frames;
+    unsigned int                hqscaling_probe_frames; /* on-time frames needed to step up */
     VdpColorStandard            vdp_colorspace;
     VdpProcamp                  vdp_procamp;
     uint64_t                    vdp_procamp_mtime;
@@ -79,6 +86,12 @@ video_mixer_set_background_color(
     const VdpColor      *vdp_color
 ) attribute_hidden;
 
+void
+video_mixer_hqscaling_feedback(
+    object_mixer_p       obj_mixer,
+    int                  is_late
+) attribute_hidden;
+
 VdpStatus
 video_mixer_render(
     vdpau_driver_data_t *driver_data,
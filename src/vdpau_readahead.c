@@ -0,0 +1,356 @@
+/*
+ *  vdpau_readahead.c - VDPAU backend for VA-API (speculative readback)
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#include "sysdeps.h"
+#include "vdpau_readahead.h"
+#include "uasyncqueue.h"
+#include "utils.h"
+#include <pthread.h>
+
+#define DEBUG 1
+#include "debug.h"
+
+/* Number of decoded surfaces that can be read back ahead of vaGetImage() */
+#define READAHEAD_SLOTS 4
+
+typedef enum {
+    READAHEAD_FREE = 0,
+    READAHEAD_RESERVED,         /* being set up by readahead_submit() */
+    READAHEAD_QUEUED,           /* waiting for the worker */
+    READAHEAD_BUSY,             /* being read back by the worker */
+    READAHEAD_READY,
+    READAHEAD_FAILED
+} ReadaheadState;
+
+typedef struct readahead_slot readahead_slot_t;
+struct readahead_slot {
+    ReadaheadState              state;
+    VdpVideoSurface             surface;
+    vdpau_readahead_layout_t    layout;
+    void                       *buffer;
+    unsigned int                buffer_size;
+    unsigned int                sequence;
+};
+
+struct vdpau_readahead {
+    vdpau_driver_data_t        *driver_data;
+    pthread_t                   thread;
+    UAsyncQueue                *queue;
+    pthread_mutex_t             mutex;
+    pthread_cond_t              cond;
+    vdpau_readahead_layout_t    layout;         /* last layout used by vaGetImage() */
+    readahead_slot_t            slots[READAHEAD_SLOTS];
+    unsigned int                sequence;
+    /* Flags are guarded by the mutex */
+    unsigned int                has_layout;
+    unsigned int                has_thread;
+    unsigned int                quit;
+    unsigned int                hits;
+    unsigned int                misses;
+};
+
+// Get whether decoded surfaces are read back speculatively
+static int
+get_readahead_env(void)
+{
+    static int g_readahead = -1;
+    if (g_readahead < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_READAHEAD", &g_readahead) < 0)
+            g_readahead = 0;
+    }
+    return g_readahead;
+}
+
+// Worker thread: reads queued surfaces back into their staging buffers
+static void *
+readahead_thread(void *arg)
+{
+    vdpau_readahead_t * const readahead = arg;
+    readahead_slot_t *slot;
+    uint8_t *planes[3];
+    VdpStatus vdp_status;
+    unsigned int i;
+
+    for (;;) {
+        slot = async_queue_pop(readahead->queue);
+
+        pthread_mutex_lock(&readahead->mutex);
+        if (readahead->quit) {
+            pthread_mutex_unlock(&readahead->mutex);
+            break;
+        }
+        if (!slot || slot->state != READAHEAD_QUEUED) {
+            pthread_mutex_unlock(&readahead->mutex);
+            continue;
+        }
+        slot->state = READAHEAD_BUSY;
+        pthread_mutex_unlock(&readahead->mutex);
+
+        /* The slot layout and buffer only change while it is not busy */
+        for (i = 0; i < slot->layout.num_planes; i++)
+            planes[i] = (uint8_t *)slot->buffer + slot->layout.offsets[i];
+        vdp_status = vdpau_video_surface_get_bits_ycbcr(
+            readahead->driver_data,
+            slot->surface,
+            slot->layout.vdp_format,
+            planes,
+            slot->layout.pitches
+        );
+
+        pthread_mutex_lock(&readahead->mutex);
+        slot->state = vdp_status == VDP_STATUS_OK ?
+            READAHEAD_READY : READAHEAD_FAILED;
+        pthread_cond_broadcast(&readahead->cond);
+        pthread_mutex_unlock(&readahead->mutex);
+    }
+    return NULL;
+}
+
+// Create readahead state, if speculative readback was requested
+vdpau_readahead_t *
+readahead_create(vdpau_driver_data_t *driver_data)
+{
+    vdpau_readahead_t *readahead;
+
+    if (!get_readahead_env())
+        return NULL;
+
+    readahead = calloc(1, sizeof(*readahead));
+    if (!readahead)
+        return NULL;
+
+    readahead->driver_data = driver_data;
+    readahead->queue = async_queue_new();
+    if (!readahead->queue) {
+        free(readahead);
+        return NULL;
+    }
+    pthread_mutex_init(&readahead->mutex, NULL);
+    pthread_cond_init(&readahead->cond, NULL);
+    return readahead;
+}
+
+// Destroy readahead state, waiting for the readback in progress
+void
+readahead_destroy(vdpau_readahead_t *readahead)
+{
+    unsigned int i;
+
+    if (!readahead)
+        return;
+
+    pthread_mutex_lock(&readahead->mutex);
+    const int has_thread = readahead->has_thread;
+    readahead->quit = 1;
+    pthread_mutex_unlock(&readahead->mutex);
+    if (has_thread) {
+        async_queue_push(readahead->queue, NULL);
+        pthread_join(readahead->thread, NULL);
+    }
+
+    if (readahead->hits + readahead->misses > 0)
+        D(bug("readahead: %u hits, %u misses\n",
+              readahead->hits, readahead->misses));
+
+    for (i = 0; i < READAHEAD_SLOTS; i++)
+        free(readahead->slots[i].buffer);
+    async_queue_free(readahead->queue);
+    pthread_cond_destroy(&readahead->cond);
+    pthread_mutex_destroy(&readahead->mutex);
+    free(readahead);
+}
+
+// Set the layout decoded surfaces are read back into
+void
+readahead_set_layout(
+    vdpau_readahead_t              *readahead,
+    const vdpau_readahead_layout_t *layout
+)
+{
+    if (!readahead)
+        return;
+
+    pthread_mutex_lock(&readahead->mutex);
+    readahead->layout     = *layout;
+    readahead->has_layout = 1;
+    pthread_mutex_unlock(&readahead->mutex);
+}
+
+// Wait for the worker to be done with SLOT. Called with the mutex held
+static void
+readahead_slot_wait(vdpau_readahead_t *readahead, readahead_slot_t *slot)
+{
+    while (slot->state == READAHEAD_QUEUED || slot->state == READAHEAD_BUSY)
+        pthread_cond_wait(&readahead->cond, &readahead->mutex);
+}
+
+// Look up the slot holding SURFACE. Called with the mutex held
+static readahead_slot_t *
+readahead_slot_lookup(vdpau_readahead_t *readahead, VdpVideoSurface surface)
+{
+    unsigned int i;
+
+    /* Reserved slots are owned by readahead_submit() until queued */
+    for (i = 0; i < READAHEAD_SLOTS; i++) {
+        readahead_slot_t * const slot = &readahead->slots[i];
+        if (slot->state != READAHEAD_FREE &&
+            slot->state != READAHEAD_RESERVED &&
+            slot->surface == surface)
+            return slot;
+    }
+    return NULL;
+}
+
+// Queue readback of a decoded surface
+void
+readahead_submit(vdpau_readahead_t *readahead, VdpVideoSurface surface)
+{
+    readahead_slot_t *slot = NULL;
+    vdpau_readahead_layout_t layout;
+    unsigned int i, sequence;
+
+    if (!readahead)
+        return;
+
+    /* Several threads may end pictures on the same context, the worker
+       is started once under the mutex */
+    pthread_mutex_lock(&readahead->mutex);
+    if (readahead->has_layout && !readahead->has_thread) {
+        if (pthread_create(&readahead->thread, NULL,
+                           readahead_thread, readahead) == 0)
+            readahead->has_thread = 1;
+        else
+            readahead->has_layout = 0;
+    }
+    const int is_ready = readahead->has_layout && readahead->has_thread;
+    pthread_mutex_unlock(&readahead->mutex);
+    if (!is_ready)
+        return;
+
+    readahead_cancel(readahead, surface);
+
+    /* Reuse a free slot, or the oldest readback not fetched yet */
+    pthread_mutex_lock(&readahead->mutex);
+    for (i = 0; i < READAHEAD_SLOTS; i++) {
+        readahead_slot_t * const s = &readahead->slots[i];
+        if (s->state == READAHEAD_FREE) {
+            slot = s;
+            break;
+        }
+        if ((s->state == READAHEAD_READY || s->state == READAHEAD_FAILED) &&
+            (!slot || s->sequence - slot->sequence > (1U << 31)))
+            slot = s;
+    }
+    if (slot)
+        slot->state = READAHEAD_RESERVED;
+    layout   = readahead->layout;
+    sequence = readahead->sequence++;
+    pthread_mutex_unlock(&readahead->mutex);
+    if (!slot)
+        return;
+
+    /* The slot is reserved, so nobody else looks at it until queued */
+    if (slot->buffer_size != layout.data_size) {
+        free(slot->buffer);
+        slot->buffer_size = 0;
+        slot->buffer = alloc_large_buffer(layout.data_size);
+        if (!slot->buffer) {
+            pthread_mutex_lock(&readahead->mutex);
+            slot->state = READAHEAD_FREE;
+            pthread_mutex_unlock(&readahead->mutex);
+            return;
+        }
+        slot->buffer_size = layout.data_size;
+    }
+    slot->surface  = surface;
+    slot->layout   = layout;
+    slot->sequence = sequence;
+
+    pthread_mutex_lock(&readahead->mutex);
+    slot->state = READAHEAD_QUEUED;
+    pthread_mutex_unlock(&readahead->mutex);
+    async_queue_push(readahead->queue, slot);
+}
+
+// Drop the readback of a surface that is about to change
+void
+readahead_cancel(vdpau_readahead_t *readahead, VdpVideoSurface surface)
+{
+    readahead_slot_t *slot;
+
+    if (!readahead)
+        return;
+
+    pthread_mutex_lock(&readahead->mutex);
+    slot = readahead_slot_lookup(readahead, surface);
+    if (slot) {
+        /* A queued slot is skipped by the worker once freed */
+        if (slot->state == READAHEAD_BUSY)
+            readahead_slot_wait(readahead, slot);
+        slot->state = READAHEAD_FREE;
+    }
+    pthread_mutex_unlock(&readahead->mutex);
+}
+
+// Fill *BUFFER_P with the readback of SURFACE, returns 0 if there is none
+int
+readahead_fetch(
+    vdpau_readahead_t              *readahead,
+    VdpVideoSurface                 surface,
+    const vdpau_readahead_layout_t *layout,
+    void                          **buffer_p,
+    int                             can_swap
+)
+{
+    readahead_slot_t *slot;
+    int found = 0;
+
+    if (!readahead)
+        return 0;
+
+    pthread_mutex_lock(&readahead->mutex);
+    slot = readahead_slot_lookup(readahead, surface);
+    if (slot) {
+        /* The readback is under way, finishing it is the cheapest */
+        readahead_slot_wait(readahead, slot);
+        if (slot->state == READAHEAD_READY &&
+            memcmp(&slot->layout, layout, sizeof(*layout)) == 0) {
+            /* Plane offsets include the alignment shift of *BUFFER_P */
+            if (can_swap && layout->align > 1 &&
+                ((uintptr_t)slot->buffer - (uintptr_t)*buffer_p) % layout->align != 0)
+                can_swap = 0;
+            if (can_swap) {
+                void * const buffer = *buffer_p;
+                *buffer_p = slot->buffer;
+                slot->buffer = buffer;
+            }
+            else
+                memcpy(*buffer_p, slot->buffer, layout->data_size);
+            found = 1;
+        }
+        slot->state = READAHEAD_FREE;
+    }
+    if (found)
+        ++readahead->hits;
+    else
+        ++readahead->misses;
+    pthread_mutex_unlock(&readahead->mutex);
+    return found;
+}
@@ -0,0 +1,81 @@
+/*
+ *  vdpau_readahead.h - VDPAU backend for VA-API (speculative readback)
+ *
+ *  libva-vdpau-driver (C) 2009-2011 Splitted-Desktop Systems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+#ifndef VDPAU_READAHEAD_H
+#define VDPAU_READAHEAD_H
+
+#include "vdpau_driver.h"
+
+/* Layout of the image a surface is read back into. Planes are given in
+   VDPAU order, i.e. with U/V already swapped for I420 */
+typedef struct vdpau_readahead_layout vdpau_readahead_layout_t;
+struct vdpau_readahead_layout {
+    uint32_t                    vdp_format;     /* VdpYCbCrFormat */
+    unsigned int                num_planes;
+    unsigned int                offsets[3];
+    uint32_t                    pitches[3];
+    unsigned int                data_size;
+    unsigned int                align;          /* plane alignment OFFSETS were computed for */
+};
+
+typedef struct vdpau_readahead vdpau_readahead_t;
+
+// Create readahead state, if speculative readback was requested
+vdpau_readahead_t *
+readahead_create(vdpau_driver_data_t *driver_data)
+    attribute_hidden;
+
+// Destroy readahead state, waiting for the readback in progress
+void
+readahead_destroy(vdpau_readahead_t *readahead)
+    attribute_hidden;
+
+// Set the layout decoded surfaces are read back into
+void
+readahead_set_layout(
+    vdpau_readahead_t              *readahead,
+    const vdpau_readahead_layout_t *layout
+) attribute_hidden;
+
+// Queue readback of a decoded surface
+void
+readahead_submit(vdpau_readahead_t *readahead, VdpVideoSurface surface)
+    attribute_hidden;
+
+// Drop the readback of a surface that is about to change
+void
+readahead_cancel(vdpau_readahead_t *readahead, VdpVideoSurface surface)
+    attribute_hidden;
+
+// Fill *BUFFER_P with the readback of SURFACE, returns 0 if there is none.
+// If CAN_SWAP is set, the buffer may be exchanged with the staging buffer,
+// which must then have been allocated with alloc_large_buffer(). This only
+// happens if both buffers are at the same offset from an ALIGN boundary,
+// so that the plane offsets keep their alignment; otherwise data is copied
+int
+readahead_fetch(
+    vdpau_readahead_t              *readahead,
+    VdpVideoSurface                 surface,
+    const vdpau_readahead_layout_t *layout,
+    void                          **buffer_p,
+    int                             can_swap
+) attribute_hidden;
+
+#endif /* VDPAU_READAHEAD_H */
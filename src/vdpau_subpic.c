@@ -129,63 +129,97 @@ is_supported_format(
     return vdp_status == VDP_STATUS_OK && is_supported;
 }
 
-// Append association to the subpicture
-static int
-subpicture_add_association(
-    object_subpicture_p    obj_subpicture,
-    SubpictureAssociationP assoc
+// Get an association of the subpicture with the specified rectangles and
+// flags, creating it if no surface uses one yet
+static SubpictureAssociationP
+subpicture_ensure_association(
+    object_subpicture_p obj_subpicture,
+    const VARectangle  *src_rect,
+    const VARectangle  *dst_rect,
+    unsigned int        flags
 )
 {
-    SubpictureAssociationP *assocs;
-    assocs = realloc_buffer(
-        (void **)&obj_subpicture->assocs,
-        &obj_subpicture->assocs_count_max,
-        1 + obj_subpicture->assocs_count,
-        sizeof(obj_subpicture->assocs[0])
-    );
-    if (!assocs)
-        return -1;
+    SubpictureAssociationP assoc;
+    unsigned int i;
+
+    for (i = 0; i < obj_subpicture->assocs.count; i++) {
+        assoc = obj_subpicture->assocs.data[i];
+        if (assoc->flags == flags &&
+            memcmp(&assoc->src_rect, src_rect, sizeof(*src_rect)) == 0 &&
+            memcmp(&assoc->dst_rect, dst_rect, sizeof(*dst_rect)) == 0)
+            return assoc;
+    }
+
+    assoc = malloc(sizeof(*assoc));
+    if (!assoc)
+        return NULL;
 
-    assocs[obj_subpicture->assocs_count++] = assoc;
-    return 0;
+    assoc->subpicture = obj_subpicture->base.id;
+    assoc->src_rect   = *src_rect;
+    assoc->dst_rect   = *dst_rect;
+    assoc->flags      = flags;
+    assoc->refcount   = 0;
+
+    if (!vector_append(&obj_subpicture->assocs, assoc)) {
+        free(assoc);
+        return NULL;
+    }
+    return assoc;
 }
 
-// Remove association at the specified index from the subpicture
-static inline int
-subpicture_remove_association_at(object_subpicture_p obj_subpicture, int index)
+// Release an association no longer used by any surface
+static void
+subpicture_release_association(
+    object_subpicture_p    obj_subpicture,
+    SubpictureAssociationP assoc
+)
 {
-    ASSERT(obj_subpicture->assocs && obj_subpicture->assocs_count > 0);
-    if (!obj_subpicture->assocs || obj_subpicture->assocs_count == 0)
-        return -1;
-
-    /* Replace with the last association */
-    const unsigned int last = obj_subpicture->assocs_count - 1;
-    obj_subpicture->assocs[index] = obj_subpicture->assocs[last];
-    obj_subpicture->assocs[last] = NULL;
-    obj_subpicture->assocs_count--;
-    return 0;
+    unsigned int i;
+
+    if (assoc->refcount > 0)
+        return;
+
+    for (i = 0; i < obj_subpicture->assocs.count; i++) {
+        if (obj_subpicture->assocs.data[i] == assoc) {
+            /* Replace with the last association */
+            vector_remove_fast(&obj_subpicture->assocs, i);
+            break;
+        }
+    }
+    free(assoc);
 }
 
-#if 0
-// Remove association from the subpicture
-static int
-subpicture_remove_association(
+// Attach a surface to the association, replacing its previous one
+static VAStatus
+subpicture_attach(
     object_subpicture_p    obj_subpicture,
+    object_surface_p       obj_surface,
     SubpictureAssociationP assoc
 )
 {
-    ASSERT(obj_subpicture->assocs && obj_subpicture->assocs_count > 0);
-    if (!obj_subpicture->assocs || obj_subpicture->assocs_count == 0)
-        return -1;
+    SubpictureAssociationP old_assoc;
 
-    unsigned int i;
-    for (i = 0; i < obj_subpicture->assocs_count; i++) {
-        if (obj_subpicture->assocs[i] == assoc)
-            return subpicture_remove_association_at(obj_subpicture, i);
+    old_assoc = surface_lookup_association(obj_surface, assoc->subpicture);
+    if (old_assoc == assoc)
+        return VA_STATUS_SUCCESS;
+
+    /* The previous association is swapped in place, which cannot fail,
+       so the surface never ends up without any association */
+    if (old_assoc) {
+        if (surface_replace_association(obj_surface, old_assoc, assoc) < 0)
+            return VA_STATUS_ERROR_OPERATION_FAILED;
+        ++assoc->refcount;
+        --old_assoc->refcount;
+        subpicture_release_association(obj_subpicture, old_assoc);
+        return VA_STATUS_SUCCESS;
     }
-    return -1;
+
+    if (surface_add_association(obj_surface, assoc) < 0)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    ++assoc->refcount;
+    ++obj_subpicture->num_surfaces;
+    return VA_STATUS_SUCCESS;
 }
-#endif
 
 // Associate one surface to the subpicture
 VAStatus
@@ -201,28 +235,18 @@ subpicture_associate_1(
     if (flags & ~VA_SUBPICTURE_GLOBAL_ALPHA)
         return VA_STATUS_ERROR_FLAG_NOT_SUPPORTED;
 
-    SubpictureAssociationP assoc = malloc(sizeof(*assoc));
+    SubpictureAssociationP assoc = subpicture_ensure_association(
+        obj_subpicture,
+        src_rect,
+        dst_rect,
+        flags
+    );
     if (!assoc)
         return VA_STATUS_ERROR_ALLOCATION_FAILED;
 
-    assoc->subpicture = obj_subpicture->base.id;
-    assoc->surface    = obj_surface->base.id;
-    assoc->src_rect   = *src_rect;
-    assoc->dst_rect   = *dst_rect;
-    assoc->flags      = flags;
-
-    VAStatus status = surface_add_association(obj_surface, assoc);
-    if (status !=  VA_STATUS_SUCCESS) {
-        free(assoc);
-        return status;
-    }
-
-    if (subpicture_add_association(obj_subpicture, assoc) < 0) {
-        surface_remove_association(obj_surface, assoc);
-        free(assoc);
-        return VA_STATUS_ERROR_ALLOCATION_FAILED;
-    }
-    return VA_STATUS_SUCCESS;
+    VAStatus status = subpicture_attach(obj_subpicture, obj_surface, assoc);
+    subpicture_release_association(obj_subpicture, assoc);
+    return status;
 }
 
 // Associate surfaces to the subpicture
@@ -237,19 +261,35 @@ associate_subpicture(
     unsigned int        flags
 )
 {
-    VAStatus status;
+    VAStatus status = VA_STATUS_SUCCESS;
     unsigned int i;
 
+    /* we only support the VA_SUBPICTURE_GLOBAL_ALPHA flag */
+    if (flags & ~VA_SUBPICTURE_GLOBAL_ALPHA)
+        return VA_STATUS_ERROR_FLAG_NOT_SUPPORTED;
+
+    /* All surfaces share a single association */
+    SubpictureAssociationP assoc = subpicture_ensure_association(
+        obj_subpicture,
+        src_rect,
+        dst_rect,
+        flags
+    );
+    if (!assoc)
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+
     for (i = 0; i < num_surfaces; i++) {
         object_surface_p const obj_surface = VDPAU_SURFACE(surfaces[i]);
-        if (!obj_surface)
-            return VA_STATUS_ERROR_INVALID_SURFACE;
-        status = subpicture_associate_1(obj_subpicture, obj_surface,
-                                        src_rect, dst_rect, flags);
+        if (!obj_surface) {
+            status = VA_STATUS_ERROR_INVALID_SURFACE;
+            break;
+        }
+        status = subpicture_attach(obj_subpicture, obj_surface, assoc);
         if (status != VA_STATUS_SUCCESS)
-            return status;
+            break;
     }
-    return VA_STATUS_SUCCESS;
+    subpicture_release_association(obj_subpicture, assoc);
+    return status;
 }
 
 // Deassociate one surface from the subpicture
@@ -259,22 +299,18 @@ subpicture_deassociate_1(
     object_surface_p    obj_surface
 )
 {
-    ASSERT(obj_subpicture->assocs && obj_subpicture->assocs_count > 0);
-    if (!obj_subpicture->assocs || obj_subpicture->assocs_count == 0)
+    SubpictureAssociationP assoc;
+
+    assoc = surface_lookup_association(obj_surface, obj_subpicture->base.id);
+    if (!assoc)
         return VA_STATUS_ERROR_OPERATION_FAILED;
 
-    unsigned int i;
-    for (i = 0; i < obj_subpicture->assocs_count; i++) {
-        SubpictureAssociationP const assoc = obj_subpicture->assocs[i];
-        ASSERT(assoc);
-        if (assoc && assoc->surface == obj_surface->base.id) {
-            surface_remove_association(obj_surface, assoc);
-            subpicture_remove_association_at(obj_subpicture, i);
-            free(assoc);
-            return VA_STATUS_SUCCESS;
-        }
-    }
-    return VA_STATUS_ERROR_OPERATION_FAILED;
+    surface_remove_association(obj_surface, assoc);
+    ASSERT(assoc->refcount > 0);
+    --assoc->refcount;
+    --obj_subpicture->num_surfaces;
+    subpicture_release_association(obj_subpicture, assoc);
+    return VA_STATUS_SUCCESS;
 }
 
 // Deassociate surfaces from the subpicture
@@ -341,8 +377,8 @@ commit_subpicture(
     dirty_rect.y1 = 0;
 
     unsigned int i;
-    for (i = 0; i < obj_subpicture->assocs_count; i++) {
-        const VARectangle * const rect = &obj_subpicture->assocs[i]->src_rect;
+    for (i = 0; i < obj_subpicture->assocs.count; i++) {
+        const VARectangle * const rect = &obj_subpicture->assocs.data[i]->src_rect;
         dirty_rect.x0 = MIN(dirty_rect.x0, rect->x);
         dirty_rect.y0 = MIN(dirty_rect.y0, rect->y);
         dirty_rect.x1 = MAX(dirty_rect.x1, rect->x + rect->width);
@@ -409,9 +445,8 @@ create_subpicture(
         return VA_STATUS_ERROR_UNKNOWN; /* VA_STATUS_ERROR_UNSUPPORTED_FORMAT */
 
     obj_subpicture->image_id           = obj_image->base.id;
-    obj_subpicture->assocs             = NULL;
-    obj_subpicture->assocs_count       = 0;
-    obj_subpicture->assocs_count_max   = 0;
+    vector_init(&obj_subpicture->assocs);
+    obj_subpicture->num_surfaces       = 0;
     obj_subpicture->width              = obj_image->image.width;
     obj_subpicture->height             = obj_image->image.height;
     obj_subpicture->vdp_bitmap_surface = VDP_INVALID_HANDLE;
@@ -458,32 +493,27 @@ destroy_subpicture(
     object_subpicture_p obj_subpicture
 )
 {
-    object_surface_p obj_surface;
-    VAStatus status;
-    unsigned int i, n;
-
-    if (obj_subpicture->assocs) {
-        const unsigned int n_assocs = obj_subpicture->assocs_count;
-        for (i = 0, n = 0; i < n_assocs; i++) {
-            SubpictureAssociationP const assoc = obj_subpicture->assocs[0];
-            if (!assoc)
-                continue;
-            obj_surface = VDPAU_SURFACE(assoc->surface);
-            if (!obj_surface)
-                continue;
-            status = subpicture_deassociate_1(obj_subpicture, obj_surface);
-            if (status == VA_STATUS_SUCCESS)
-                ++n;
+    /* Surfaces do not point back to associations, look them up */
+    if (obj_subpicture->num_surfaces > 0) {
+        object_heap_iterator iter;
+        object_base_p obj = object_heap_first(&driver_data->surface_heap, &iter);
+        while (obj && obj_subpicture->num_surfaces > 0) {
+            subpicture_deassociate_1(obj_subpicture, (object_surface_p)obj);
+            obj = object_heap_next(&driver_data->surface_heap, &iter);
         }
-        if (n != n_assocs)
+        if (obj_subpicture->num_surfaces > 0)
             vdpau_error_message("vaDestroySubpicture(): subpicture 0x%08x still "
-                               "has %d surfaces associated to it\n",
-                               obj_subpicture->base.id, n_assocs - n);
-        free(obj_subpicture->assocs);
-        obj_subpicture->assocs = NULL;
+                               "has %u surfaces associated to it\n",
+                               obj_subpicture->base.id,
+                               obj_subpicture->num_surfaces);
+    }
+
+    /* Free associations left over by surfaces that could not be found */
+    while (obj_subpicture->assocs.count > 0) {
+        free(obj_subpicture->assocs.data[obj_subpicture->assocs.count - 1]);
+        obj_subpicture->assocs.count--;
     }
-    obj_subpicture->assocs_count = 0;
-    obj_subpicture->assocs_count_max = 0;
+    vector_free(&obj_subpicture->assocs);
 
     if (obj_subpicture->vdp_bitmap_surface != VDP_INVALID_HANDLE) {
         vdpau_bitmap_surface_destroy(
@@ -30,9 +30,8 @@ typedef struct object_subpicture *object_subpicture_p;
 struct object_subpicture {
     struct object_base  base;
     VAImageID           image_id;
-    SubpictureAssociationP *assocs;
-    unsigned int        assocs_count;
-    unsigned int        assocs_count_max;
+    UVECTOR(SubpictureAssociationP, 4) assocs; /* distinct associations, shared by surfaces */
+    unsigned int        num_surfaces;  /* number of surfaces associated */
     unsigned int        chromakey_min;
     unsigned int        chromakey_max;
     unsigned int        chromakey_mask;
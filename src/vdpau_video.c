@@ -35,6 +35,10 @@
    with polling. */
 #define VDPAU_SYNC_DELAY 5000
 
+/* Define how long (in microseconds) a VISIBLE or IDLE presentation queue
+   status is reused before asking VDPAU again, i.e. about one vsync. */
+#define VDPAU_STATUS_CACHE_TIME 16000
+
 // Translates VA-API chroma format to VdpChromaType
 static VdpChromaType get_VdpChromaType(int format)
 {
@@ -244,6 +248,21 @@ vdpau_QueryConfigAttributes(
     return va_status;
 }
 
+// Look up the association of a subpicture to surface
+SubpictureAssociationP
+surface_lookup_association(
+    object_surface_p            obj_surface,
+    VASubpictureID              subpicture
+)
+{
+    unsigned int i;
+    for (i = 0; i < obj_surface->assocs.count; i++) {
+        if (obj_surface->assocs.data[i]->subpicture == subpicture)
+            return obj_surface->assocs.data[i];
+    }
+    return NULL;
+}
+
 // Add subpicture association to surface
 // NOTE: the subpicture owns the SubpictureAssociation object
 int surface_add_association(
@@ -251,37 +270,18 @@ int surface_add_association(
     SubpictureAssociationP      assoc
 )
 {
-    /* Check that we don't already have this association */
-    if (obj_surface->assocs) {
-        unsigned int i;
-        for (i = 0; i < obj_surface->assocs_count; i++) {
-            if (obj_surface->assocs[i] == assoc)
-                return 0;
-            if (obj_surface->assocs[i]->subpicture == assoc->subpicture) {
-                /* XXX: this should not happen, but replace it in the interim */
-                ASSERT(obj_surface->assocs[i]->surface == assoc->surface);
-                obj_surface->assocs[i] = assoc;
-                return 0;
-            }
-        }
-    }
+    /* The subpicture replaces any previous association first */
+    ASSERT(!surface_lookup_association(obj_surface, assoc->subpicture));
 
     /* Check that we have not reached the maximum subpictures capacity yet */
-    if (obj_surface->assocs_count >= VDPAU_MAX_SUBPICTURES)
+    if (obj_surface->assocs.count >= VDPAU_MAX_SUBPICTURES)
         return -1;
 
     /* Append this subpicture association */
-    SubpictureAssociationP *assocs;
-    assocs = realloc_buffer(
-        (void **)&obj_surface->assocs,
-        &obj_surface->assocs_count_max,
-        1 + obj_surface->assocs_count,
-        sizeof(obj_surface->assocs[0])
-    );
-    if (!assocs)
+    if (!vector_append(&obj_surface->assocs, assoc))
         return -1;
-
-    assocs[obj_surface->assocs_count++] = assoc;
+    obj_surface->mirror_output_id = VA_INVALID_ID;
+    obj_surface->update_count++;
     return 0;
 }
 
@@ -292,17 +292,33 @@ int surface_remove_association(
     SubpictureAssociationP      assoc
 )
 {
-    if (!obj_surface->assocs || obj_surface->assocs_count == 0)
-        return -1;
-
     unsigned int i;
-    const unsigned int last = obj_surface->assocs_count - 1;
-    for (i = 0; i <= last; i++) {
-        if (obj_surface->assocs[i] == assoc) {
+    for (i = 0; i < obj_surface->assocs.count; i++) {
+        if (obj_surface->assocs.data[i] == assoc) {
             /* Swap with the last subpicture */
-            obj_surface->assocs[i] = obj_surface->assocs[last];
-            obj_surface->assocs[last] = NULL;
-            obj_surface->assocs_count--;
+            vector_remove_fast(&obj_surface->assocs, i);
+            obj_surface->mirror_output_id = VA_INVALID_ID;
+            obj_surface->update_count++;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Replace subpicture association of surface, keeping its stacking order
+// NOTE: the subpicture owns the SubpictureAssociation objects
+int surface_replace_association(
+    object_surface_p            obj_surface,
+    SubpictureAssociationP      old_assoc,
+    SubpictureAssociationP      new_assoc
+)
+{
+    unsigned int i;
+    for (i = 0; i < obj_surface->assocs.count; i++) {
+        if (obj_surface->assocs.data[i] == old_assoc) {
+            obj_surface->assocs.data[i] = new_assoc;
+            obj_surface->mirror_output_id = VA_INVALID_ID;
+            obj_surface->update_count++;
             return 0;
         }
     }
@@ -327,30 +343,29 @@ vdpau_DestroySurfaces(
             continue;
 
         if (obj_surface->vdp_surface != VDP_INVALID_HANDLE) {
+            object_context_p obj_context = VDPAU_CONTEXT(obj_surface->va_context);
+            if (obj_context)
+                readahead_cancel(obj_context->readahead, obj_surface->vdp_surface);
             vdpau_video_surface_destroy(driver_data, obj_surface->vdp_surface);
             obj_surface->vdp_surface = VDP_INVALID_HANDLE;
         }
 
-        for (j = 0; j < obj_surface->output_surfaces_count; j++) {
-            output_surface_unref(driver_data, obj_surface->output_surfaces[j]);
-            obj_surface->output_surfaces[j] = NULL;
-        }
-        free(obj_surface->output_surfaces);
-        obj_surface->output_surfaces_count = 0;
-        obj_surface->output_surfaces_count_max = 0;
+        for (j = 0; j < obj_surface->output_surfaces.count; j++)
+            output_surface_unref(driver_data, obj_surface->output_surfaces.data[j]);
+        vector_free(&obj_surface->output_surfaces);
 
         if (obj_surface->video_mixer) {
             video_mixer_unref(driver_data, obj_surface->video_mixer);
             obj_surface->video_mixer = NULL;
         }
 
-        if (obj_surface->assocs) {
+        if (obj_surface->assocs.count > 0) {
             object_subpicture_p obj_subpicture;
             VAStatus status;
-            const unsigned int n_assocs = obj_surface->assocs_count;
+            const unsigned int n_assocs = obj_surface->assocs.count;
 
             for (j = 0, n = 0; j < n_assocs; j++) {
-                SubpictureAssociationP const assoc = obj_surface->assocs[0];
+                SubpictureAssociationP const assoc = obj_surface->assocs.data[0];
                 ASSERT(assoc);
                 if (!assoc)
                     continue;
@@ -366,11 +381,8 @@ vdpau_DestroySurfaces(
                 vdpau_error_message("vaDestroySurfaces(): surface 0x%08x still "
                                     "has %d subpictures associated to it\n",
                                     obj_surface->base.id, n_assocs - n);
-            free(obj_surface->assocs);
-            obj_surface->assocs = NULL;
         }
-        obj_surface->assocs_count = 0;
-        obj_surface->assocs_count_max = 0;
+        vector_free(&obj_surface->assocs);
 
         object_heap_free(&driver_data->surface_heap, (object_base_p)obj_surface);
     }
@@ -424,13 +436,13 @@ vdpau_CreateSurfaces(
         obj_surface->vdp_surface                = vdp_surface;
         obj_surface->width                      = width;
         obj_surface->height                     = height;
-        obj_surface->assocs                     = NULL;
-        obj_surface->assocs_count               = 0;
-        obj_surface->assocs_count_max           = 0;
         obj_surface->vdp_chroma_type            = vdp_chroma_type;
-        obj_surface->output_surfaces            = NULL;
-        obj_surface->output_surfaces_count      = 0;
-        obj_surface->output_surfaces_count_max  = 0;
+        obj_surface->is_shed                    = 0;
+        obj_surface->repeat_surface             = VA_INVALID_SURFACE;
+        obj_surface->mirror_output_id           = VA_INVALID_ID;
+        obj_surface->update_count               = 0;
+        vector_init(&obj_surface->assocs);
+        vector_init(&obj_surface->output_surfaces);
         obj_surface->video_mixer                = NULL;
         surfaces[i]                             = va_surface;
         vdp_surface                             = VDP_INVALID_HANDLE;
@@ -463,6 +475,11 @@ VAStatus vdpau_DestroyContext(VADriverContextP ctx, VAContextID context)
     if (!obj_context)
         return VA_STATUS_ERROR_INVALID_CONTEXT;
 
+    if (obj_context->readahead) {
+        readahead_destroy(obj_context->readahead);
+        obj_context->readahead = NULL;
+    }
+
     if (obj_context->gen_slice_data) {
         free(obj_context->gen_slice_data);
         obj_context->gen_slice_data = NULL;
@@ -470,12 +487,7 @@ VAStatus vdpau_DestroyContext(VADriverContextP ctx, VAContextID context)
         obj_context->gen_slice_data_size_max = 0;
     }
 
-    if (obj_context->vdp_bitstream_buffers) {
-        free(obj_context->vdp_bitstream_buffers);
-        obj_context->vdp_bitstream_buffers = NULL;
-        obj_context->vdp_bitstream_buffers_count = 0;
-        obj_context->vdp_bitstream_buffers_count_max = 0;
-    }
+    vector_free(&obj_context->vdp_bitstream_buffers);
 
     if (obj_context->vdp_decoder != VDP_INVALID_HANDLE) {
         vdpau_decoder_destroy(driver_data, obj_context->vdp_decoder);
@@ -483,10 +495,13 @@ VAStatus vdpau_DestroyContext(VADriverContextP ctx, VAContextID context)
     }
 
     destroy_dead_va_buffers(driver_data, obj_context);
-    if (obj_context->dead_buffers) {
-        free(obj_context->dead_buffers);
-        obj_context->dead_buffers = NULL;
-    }
+
+    if (obj_context->shed_pictures > 0)
+        vdpau_information_message("context 0x%08x shed %u of %u pictures\n",
+                                  obj_context->base.id,
+                                  obj_context->shed_pictures,
+                                  obj_context->decoded_pictures +
+                                  obj_context->shed_pictures);
 
     if (obj_context->render_targets) {
         for (i = 0; i < obj_context->num_render_targets; i++) {
@@ -506,10 +521,11 @@ VAStatus vdpau_DestroyContext(VADriverContextP ctx, VAContextID context)
     obj_context->picture_height         = 0;
     obj_context->num_render_targets     = 0;
     obj_context->flags                  = 0;
-    obj_context->dead_buffers_count     = 0;
-    obj_context->dead_buffers_count_max = 0;
 
     object_heap_free(&driver_data->context_heap, (object_base_p)obj_context);
+
+    /* The end of a stream is a good time to give peak allocations back */
+    vdpau_trim_memory(driver_data);
     return VA_STATUS_SUCCESS;
 }
 
@@ -556,6 +572,10 @@ vdpau_CreateContext(
     if (context)
         *context = context_id;
 
+    obj_context->create_ticks           = get_ticks_usec();
+    obj_context->create_usec            = 0;
+    obj_context->decoder_create_usec    = 0;
+    obj_context->first_picture_ticks    = 0;
     obj_context->context_id             = context_id;
     obj_context->config_id              = config_id;
     obj_context->current_render_target  = VA_INVALID_SURFACE;
@@ -567,17 +587,21 @@ vdpau_CreateContext(
     obj_context->render_targets         = (VASurfaceID *)
         calloc(num_render_targets, sizeof(VASurfaceID));
     obj_context->dead_buffers           = NULL;
-    obj_context->dead_buffers_count     = 0;
-    obj_context->dead_buffers_count_max = 0;
+    obj_context->decoded_pictures       = 0;
+    obj_context->shed_pictures          = 0;
+    obj_context->last_decoded_surface   = VA_INVALID_SURFACE;
+    obj_context->last_iq_matrix_size    = 0;
     obj_context->vdp_codec              = get_VdpCodec(vdp_profile);
     obj_context->vdp_profile            = vdp_profile;
     obj_context->vdp_decoder            = VDP_INVALID_HANDLE;
     obj_context->gen_slice_data = NULL;
     obj_context->gen_slice_data_size = 0;
     obj_context->gen_slice_data_size_max = 0;
-    obj_context->vdp_bitstream_buffers = NULL;
-    obj_context->vdp_bitstream_buffers_count = 0;
-    obj_context->vdp_bitstream_buffers_count_max = 0;
+    obj_context->gen_slice_data_size_peak = 0;
+    obj_context->vdp_bitstream_buffers_peak = 0;
+    obj_context->trim_pictures = 0;
+    obj_context->readahead = readahead_create(driver_data);
+    vector_init(&obj_context->vdp_bitstream_buffers);
 
     if (!obj_context->render_targets) {
         vdpau_DestroyContext(ctx, context_id);
@@ -595,14 +619,59 @@ vdpau_CreateContext(
         ASSERT(obj_surface->va_context == VA_INVALID_ID);
         obj_surface->va_context = context_id;
     }
+
+    VAStatus va_status = warmup_decoder(driver_data, obj_context);
+    if (va_status != VA_STATUS_SUCCESS) {
+        vdpau_DestroyContext(ctx, context_id);
+        return va_status;
+    }
+    obj_context->create_usec = get_ticks_usec() - obj_context->create_ticks;
     return VA_STATUS_SUCCESS;
 }
 
-// Query surface status
-VAStatus
-query_surface_status(
+// Query status of the output surface last queued for display
+static VdpStatus
+query_output_status(
+    vdpau_driver_data_t        *driver_data,
+    object_output_p             obj_output,
+    uint64_t                    now,
+    VdpPresentationQueueStatus *status
+)
+{
+    /* Surfaces sharing a drawable also share its output, so a batch of
+       queries results in a single VDPAU call per presentation queue */
+    if (obj_output->displayed_status_time &&
+        now - obj_output->displayed_status_time < VDPAU_STATUS_CACHE_TIME) {
+        *status = obj_output->displayed_status;
+        return VDP_STATUS_OK;
+    }
+
+    VdpTime vdp_dummy_time;
+    VdpStatus vdp_status;
+    vdp_status = vdpau_presentation_queue_query_surface_status(
+        driver_data,
+        obj_output->vdp_flip_queue,
+        obj_output->vdp_output_surfaces[obj_output->displayed_output_surface],
+        status,
+        &vdp_dummy_time
+    );
+    if (vdp_status != VDP_STATUS_OK)
+        return vdp_status;
+
+    /* Only final states are cached, QUEUED changes at the next vsync */
+    if (*status != VDP_PRESENTATION_QUEUE_STATUS_QUEUED) {
+        obj_output->displayed_status      = *status;
+        obj_output->displayed_status_time = now;
+    }
+    return VDP_STATUS_OK;
+}
+
+// Query surface status at the specified time
+static VAStatus
+query_surface_status_at(
     vdpau_driver_data_t *driver_data,
     object_surface_p     obj_surface,
+    uint64_t             now,
     VASurfaceStatus     *status
 )
 {
@@ -610,8 +679,8 @@ query_surface_status(
 
     if (obj_surface->va_surface_status == VASurfaceDisplaying) {
         unsigned int i, num_output_surfaces_displaying = 0;
-        for (i = 0; i < obj_surface->output_surfaces_count; i++) {
-            object_output_p obj_output = obj_surface->output_surfaces[i];
+        for (i = 0; i < obj_surface->output_surfaces.count; i++) {
+            object_output_p obj_output = obj_surface->output_surfaces.data[i];
             if (!obj_output)
                 return VA_STATUS_ERROR_INVALID_SURFACE;
 
@@ -621,14 +690,12 @@ query_surface_status(
                 continue;
 
             VdpPresentationQueueStatus vdp_queue_status;
-            VdpTime vdp_dummy_time;
             VdpStatus vdp_status;
-            vdp_status = vdpau_presentation_queue_query_surface_status(
+            vdp_status = query_output_status(
                 driver_data,
-                obj_output->vdp_flip_queue,
-                vdp_output_surface,
-                &vdp_queue_status,
-                &vdp_dummy_time
+                obj_output,
+                now,
+                &vdp_queue_status
             );
             va_status = vdpau_get_VAStatus(vdp_status);
 
@@ -646,6 +713,47 @@ query_surface_status(
     return va_status;
 }
 
+// Query surface status
+VAStatus
+query_surface_status(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface,
+    VASurfaceStatus     *status
+)
+{
+    return query_surface_status_at(driver_data, obj_surface,
+                                   get_ticks_usec(), status);
+}
+
+// Count surfaces still waiting to be displayed
+unsigned int
+count_displaying_surfaces(
+    vdpau_driver_data_t *driver_data,
+    const VASurfaceID   *surfaces,
+    unsigned int         num_surfaces
+)
+{
+    const uint64_t now = get_ticks_usec();
+    unsigned int i, count = 0;
+
+    for (i = 0; i < num_surfaces; i++) {
+        object_surface_p obj_surface = VDPAU_SURFACE(surfaces[i]);
+        if (!obj_surface ||
+            obj_surface->va_surface_status != VASurfaceDisplaying)
+            continue;
+
+        /* Outputs cache their queue status, so surfaces sharing a
+           drawable cost at most one VDPAU query in total */
+        VASurfaceStatus va_surface_status;
+        if (query_surface_status_at(driver_data, obj_surface, now,
+                                    &va_surface_status) != VA_STATUS_SUCCESS)
+            continue;
+        if (va_surface_status == VASurfaceDisplaying)
+            ++count;
+    }
+    return count;
+}
+
 // vaQuerySurfaceStatus
 VAStatus
 vdpau_QuerySurfaceStatus(
@@ -660,6 +768,7 @@ vdpau_QuerySurfaceStatus(
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
 
+    flush_surface_mosaics(driver_data, render_target);
     return query_surface_status(driver_data, obj_surface, status);
 }
 
@@ -670,6 +779,10 @@ sync_surface(
     object_surface_p     obj_surface
 )
 {
+    /* A surface still waiting for the rest of its mosaic round would
+       never be displayed, and neither would an overdue round */
+    flush_surface_mosaics(driver_data, obj_surface->base.id);
+
     /* VDPAU only supports status interface for in-progress display */
     /* XXX: polling is bad but there currently is no alternative */
     for (;;) {
@@ -23,14 +23,18 @@
 
 #include "vdpau_driver.h"
 #include "vdpau_decode.h"
+#include "vdpau_readahead.h"
+#include "uvector.h"
 
+/* An association is shared by all surfaces a subpicture was associated
+   to with the same rectangles and flags */
 typedef struct SubpictureAssociation *SubpictureAssociationP;
 struct SubpictureAssociation {
     VASubpictureID               subpicture;
-    VASurfaceID                  surface;
     VARectangle                  src_rect;
     VARectangle                  dst_rect;
     unsigned int                 flags;
+    unsigned int                 refcount;      /* number of surfaces using it */
 };
 
 typedef struct object_config object_config_t;
@@ -45,30 +49,47 @@ struct object_config {
 typedef struct object_context object_context_t;
 struct object_context {
     struct object_base           base;
+    /* Fields accessed for every picture (Begin/Render/EndPicture) */
+    VASurfaceID                  current_render_target;
+    VdpDecoder                   vdp_decoder;
+    VdpCodec                     vdp_codec;
+    VdpDecoderProfile            vdp_profile;
+    int                          max_ref_frames;
+    unsigned int                 last_slice_params_count;
+    void                        *last_pic_param;
+    void                        *last_slice_params;
+    UVECTOR(VdpBitstreamBuffer, 4) vdp_bitstream_buffers;
+    unsigned int                 gen_slice_data_size;
+    unsigned int                 gen_slice_data_size_max;
+    uint8_t                     *gen_slice_data;
+    object_buffer_p              dead_buffers;
+    unsigned int                 gen_slice_data_size_peak;
+    unsigned int                 vdp_bitstream_buffers_peak;
+    unsigned int                 trim_pictures;
+    vdpau_readahead_t           *readahead;     /* speculative readback, NULL if disabled */
+    unsigned int                 decoded_pictures;
+    unsigned int                 shed_pictures;
+    VASurfaceID                  last_decoded_surface;
+    uint64_t                     first_picture_ticks;
+    /* Fields accessed at creation time, or per picture by opt-in load
+       shedding only */
     VAContextID                  context_id;
     VAConfigID                   config_id;
-    VASurfaceID                  current_render_target;
     int                          picture_width;
     int                          picture_height;
     int                          num_render_targets;
     int                          flags;
-    int                          max_ref_frames;
     VASurfaceID                 *render_targets;
-    VABufferID                  *dead_buffers;
-    uint32_t                     dead_buffers_count;
-    uint32_t                     dead_buffers_count_max;
-    void                        *last_pic_param;
-    void                        *last_slice_params;
-    unsigned int                 last_slice_params_count;
-    VdpCodec                     vdp_codec;
-    VdpDecoderProfile            vdp_profile;
-    VdpDecoder                   vdp_decoder;
-    uint8_t                     *gen_slice_data;
-    unsigned int                 gen_slice_data_size;
-    unsigned int                 gen_slice_data_size_max;
-    VdpBitstreamBuffer          *vdp_bitstream_buffers;
-    unsigned int                 vdp_bitstream_buffers_count;
-    unsigned int                 vdp_bitstream_buffers_count_max;
+    uint64_t                     create_ticks;
+    uint64_t                     create_usec;
+    uint64_t                     decoder_create_usec;
+    /* Per-picture state too large to keep with the fields above */
+    unsigned int                 last_iq_matrix_size;
+    union {
+        VAIQMatrixBufferMPEG2    mpeg2;
+        VAIQMatrixBufferMPEG4    mpeg4;
+        VAIQMatrixBufferH264     h264;
+    }                            last_iq_matrix;
     union {
         VdpPictureInfoMPEG1Or2   mpeg2;
 #if HAVE_VDPAU_MPEG4
@@ -82,19 +103,26 @@ struct object_context {
 typedef struct object_surface object_surface_t;
 struct object_surface {
     struct object_base           base;
-    VAContextID                  va_context;
-    VASurfaceStatus              va_surface_status;
+    /* Fields accessed on every decode, sync and put operation */
     VdpVideoSurface              vdp_surface;
-    object_output_p             *output_surfaces;
-    unsigned int                 output_surfaces_count;
-    unsigned int                 output_surfaces_count_max;
+    VASurfaceStatus              va_surface_status;
+    VAContextID                  va_context;
+    VdpChromaType                vdp_chroma_type;
+    unsigned int                 is_shed : 1;
+    VASurfaceID                  repeat_surface;    /* picture shown instead of a shed one */
     object_mixer_p               video_mixer;
     unsigned int                 width;
     unsigned int                 height;
-    VdpChromaType                vdp_chroma_type;
-    SubpictureAssociationP      *assocs;
-    unsigned int                 assocs_count;
-    unsigned int                 assocs_count_max;
+    UVECTOR(object_output_p, 2)  output_surfaces;
+    UVECTOR(SubpictureAssociationP, 2) assocs;
+    /* Picture mixed by the last vaPutSurface(), for mirroring */
+    VAGenericID                  mirror_output_id;
+    VdpOutputSurface             mirror_output_surface;
+    unsigned int                 mirror_sequence;
+    unsigned int                 mirror_flags;
+    VARectangle                  mirror_src_rect;
+    VdpRect                      mirror_dst_rect;
+    unsigned int                 update_count; /* bumped whenever the picture changes */
 };
 
 // Query surface status
@@ -105,6 +133,14 @@ query_surface_status(
     VASurfaceStatus     *status
 ) attribute_hidden;
 
+// Count surfaces still waiting to be displayed
+unsigned int
+count_displaying_surfaces(
+    vdpau_driver_data_t *driver_data,
+    const VASurfaceID   *surfaces,
+    unsigned int         num_surfaces
+) attribute_hidden;
+
 // Wait for the surface to complete pending operations
 VAStatus
 sync_surface(
@@ -112,6 +148,13 @@ sync_surface(
     object_surface_p     obj_surface
 ) attribute_hidden;
  
+// Look up the association of a subpicture to surface
+SubpictureAssociationP
+surface_lookup_association(
+    object_surface_p            obj_surface,
+    VASubpictureID              subpicture
+) attribute_hidden;
+
 // Add subpicture association to surface
 // NOTE: the subpicture owns the SubpictureAssociation object
 int surface_add_association(
@@ -126,6 +169,14 @@ int surface_remove_association(
     SubpictureAssociationP      assoc
 ) attribute_hidden;
 
+// Replace subpicture association of surface, keeping its stacking order
+// NOTE: the subpicture owns the SubpictureAssociation objects
+int surface_replace_association(
+    object_surface_p            obj_surface,
+    SubpictureAssociationP      old_assoc,
+    SubpictureAssociationP      new_assoc
+) attribute_hidden;
+
 // vaGetConfigAttributes
 VAStatus
 vdpau_GetConfigAttributes(
@@ -40,6 +40,9 @@
  */
 #define VDPAU_GL_INTEROP 2
 
+/* Define wait delay (in microseconds) for frames presented to pixmaps */
+#define VDPAU_PIXMAP_SYNC_DELAY 1000
+
 static int get_vdpau_gl_interop_env(void)
 {
     GLVTable * const gl_vtable = gl_get_vtable();
@@ -64,6 +67,20 @@ static inline int vdpau_gl_interop(void)
     return g_vdpau_gl_interop;
 }
 
+/* Keep the TFP pixmap bound across frames, instead of binding it in
+ * vaBeginRenderSurfaceGLX() and releasing it in vaEndRenderSurfaceGLX().
+ * This relies on the GLX implementation reflecting X rendering into a
+ * bound pixmap, as compositors without "strict binding" do. */
+static inline int vdpau_persistent_tfp(void)
+{
+    static int g_persistent_tfp = -1;
+    if (g_persistent_tfp < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_PERSISTENT_TFP", &g_persistent_tfp) < 0)
+            g_persistent_tfp = 0;
+    }
+    return g_persistent_tfp;
+}
+
 // Ensure GLX TFP and FBO extensions are available
 static inline int ensure_extensions(void)
 {
@@ -455,6 +472,7 @@ associate_glx_surface(
         );
         if (va_status != VA_STATUS_SUCCESS)
             return va_status;
+        obj_glx_surface->pixo->is_dirty = 1;
 
         /* Force rendering of fields now */
         if ((flags ^ (VA_TOP_FIELD|VA_BOTTOM_FIELD)) != 0) {
@@ -523,7 +541,8 @@ deassociate_glx_surface(
     object_glx_surface_p obj_glx_surface
 )
 {
-    if (!vdpau_gl_interop()) {
+    /* A persistent binding is only released with the surface */
+    if (!vdpau_gl_interop() && !vdpau_persistent_tfp()) {
         if (!gl_unbind_pixmap_object(obj_glx_surface->pixo))
             return VA_STATUS_ERROR_OPERATION_FAILED;
     }
@@ -575,6 +594,50 @@ sync_glx_surface(
     return sync_surface(driver_data, obj_surface);
 }
 
+// Wait for the frame last queued to the TFP pixmap to be presented into it
+static VAStatus
+sync_glx_pixmap(
+    vdpau_driver_data_t *driver_data,
+    object_glx_surface_p obj_glx_surface
+)
+{
+    object_surface_p obj_surface = VDPAU_SURFACE(obj_glx_surface->va_surface);
+    if (!obj_surface)
+        return VA_STATUS_SUCCESS;
+
+    object_output_p obj_output;
+    obj_output = output_surface_lookup(obj_surface, obj_glx_surface->pixo->pixmap);
+    if (!obj_output)
+        return VA_STATUS_SUCCESS;
+
+    VdpOutputSurface vdp_output_surface;
+    vdp_output_surface = obj_output->vdp_output_surfaces[obj_output->displayed_output_surface];
+    if (vdp_output_surface == VDP_INVALID_HANDLE)
+        return VA_STATUS_SUCCESS;
+
+    /* VDPAU writes the pixmap outside of the X request stream, so
+       glXWaitX() alone does not order it before GL reads. Once the
+       surface is no longer queued, its contents reached the pixmap */
+    for (;;) {
+        VdpPresentationQueueStatus vdp_queue_status;
+        VdpTime vdp_dummy_time;
+        VdpStatus vdp_status;
+        vdp_status = vdpau_presentation_queue_query_surface_status(
+            driver_data,
+            obj_output->vdp_flip_queue,
+            vdp_output_surface,
+            &vdp_queue_status,
+            &vdp_dummy_time
+        );
+        if (!VDPAU_CHECK_STATUS(vdp_status, "VdpPresentationQueueQuerySurfaceStatus()"))
+            return vdpau_get_VAStatus(vdp_status);
+        if (vdp_queue_status != VDP_PRESENTATION_QUEUE_STATUS_QUEUED)
+            break;
+        delay_usec(VDPAU_PIXMAP_SYNC_DELAY);
+    }
+    return VA_STATUS_SUCCESS;
+}
+
 VAStatus
 vdpau_SyncSurfaceGLX(
     VADriverContextP ctx,
@@ -619,6 +682,13 @@ begin_render_glx_surface(
         if (!gl_vdpau_bind_surface(obj_glx_surface->gl_surface))
             return VA_STATUS_ERROR_OPERATION_FAILED;
     }
+    else if (vdpau_persistent_tfp()) {
+        va_status = sync_glx_pixmap(driver_data, obj_glx_surface);
+        if (va_status != VA_STATUS_SUCCESS)
+            return va_status;
+        if (!gl_update_pixmap_object(obj_glx_surface->pixo))
+            return VA_STATUS_ERROR_OPERATION_FAILED;
+    }
     else {
         if (!gl_bind_pixmap_object(obj_glx_surface->pixo))
             return VA_STATUS_ERROR_OPERATION_FAILED;
@@ -666,6 +736,10 @@ end_render_glx_surface(
         if (!gl_vdpau_unbind_surface(obj_glx_surface->gl_surface))
             return VA_STATUS_ERROR_OPERATION_FAILED;
     }
+    else if (vdpau_persistent_tfp()) {
+        /* Leave the texture image bound, only restore the GL binding */
+        glBindTexture(obj_glx_surface->pixo->target, 0);
+    }
     else {
         if (!gl_unbind_pixmap_object(obj_glx_surface->pixo))
             return VA_STATUS_ERROR_OPERATION_FAILED;
@@ -777,6 +851,11 @@ vdpau_CopySurfaceGLX(
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
 
+    /* The picture was shed by vaEndPicture(): the texture keeps the
+       previous frame */
+    if (obj_surface->is_shed)
+        return VA_STATUS_SUCCESS;
+
     GLContextState old_cs;
     if (!gl_set_current_context(obj_glx_surface->gl_context, &old_cs))
         return VA_STATUS_ERROR_OPERATION_FAILED;
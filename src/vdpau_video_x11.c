@@ -29,6 +29,10 @@
 #define DEBUG 1
 #include "debug.h"
 
+/* Time after which an output prepared by prebind_drawable() and not
+   presented to since is released, in microseconds */
+#define PREBIND_TIMEOUT 5000000
+
 
 // Checks whether drawable is a window
 static int is_window(Display *dpy, Drawable drawable)
@@ -131,8 +135,11 @@ output_surface_ensure_size(
                 );
                 obj_output->vdp_output_surfaces[i] = VDP_INVALID_HANDLE;
                 obj_output->vdp_output_surfaces_dirty[i] = 0;
+                obj_output->borders_valid[i] = 0;
             }
         }
+        obj_output->displayed_status_time = 0;
+        capture_discard(obj_output->capture);
     }
 
     obj_output->size_changed = (
@@ -142,8 +149,10 @@ output_surface_ensure_size(
     if (obj_output->size_changed) {
         obj_output->width  = width;
         obj_output->height = height;
-        for (i = 0; i < VDPAU_MAX_OUTPUT_SURFACES; i++)
+        for (i = 0; i < VDPAU_MAX_OUTPUT_SURFACES; i++) {
             obj_output->vdp_output_surfaces_dirty[i] = 0;
+            obj_output->borders_valid[i] = 0;
+        }
     }
 
     if (obj_output->vdp_output_surfaces[obj_output->current_output_surface] == VDP_INVALID_HANDLE) {
@@ -189,18 +198,38 @@ output_surface_create(
     obj_output->vdp_flip_target          = VDP_INVALID_HANDLE;
     obj_output->current_output_surface   = 0;
     obj_output->displayed_output_surface = 0;
+    obj_output->displayed_status_time    = 0;
     obj_output->queued_surfaces          = 0;
+    obj_output->last_presented_time      = 0;
+    obj_output->vsync_period             = 0;
+    obj_output->vsync_period_samples     = 0;
+    obj_output->cadence_base_time        = 0;
+    obj_output->cadence_frames           = 0;
+    obj_output->cadence_breaks           = 0;
+    obj_output->capture                  = NULL;
+    obj_output->mosaic_start             = 0;
+    memset(&obj_output->mosaic_last_rect, 0, sizeof(obj_output->mosaic_last_rect));
+    obj_output->prebind_time             = 0;
     obj_output->fields                   = 0;
     obj_output->is_window                = 0;
     obj_output->size_changed             = 0;
+    obj_output->is_prebound              = 0;
+    obj_output->track_latency            = 0;
 
-    if (drawable != None)
+    if (drawable != None) {
         obj_output->is_window = is_window(driver_data->x11_dpy, drawable);
+        obj_output->capture   = capture_create(driver_data, drawable);
+    }
+    vector_init(&obj_output->mosaic_tiles);
+    vector_init(&obj_output->mosaic_shown);
 
     unsigned int i;
     for (i = 0; i < VDPAU_MAX_OUTPUT_SURFACES; i++) {
         obj_output->vdp_output_surfaces[i] = VDP_INVALID_HANDLE;
         obj_output->vdp_output_surfaces_dirty[i] = 0;
+        obj_output->borders_valid[i] = 0;
+        obj_output->scheduled_times[i] = 0;
+        obj_output->queued_times[i] = 0;
     }
     pthread_mutex_init(&obj_output->vdp_output_surfaces_lock, NULL);
 
@@ -241,6 +270,17 @@ output_surface_destroy(
     if (!obj_output)
         return;
 
+    if (obj_output->is_prebound) {
+        ASSERT(driver_data->prebound_outputs > 0);
+        driver_data->prebound_outputs--;
+        obj_output->is_prebound = 0;
+    }
+
+    if (obj_output->cadence_breaks > 0)
+        vdpau_information_message("drawable 0x%08x had %u cadence breaks\n",
+                                  (unsigned int)obj_output->drawable,
+                                  obj_output->cadence_breaks);
+
     if (obj_output->vdp_flip_queue != VDP_INVALID_HANDLE) {
         vdpau_presentation_queue_destroy(
             driver_data,
@@ -257,6 +297,12 @@ output_surface_destroy(
         obj_output->vdp_flip_target = VDP_INVALID_HANDLE;
     }
 
+    /* Stop the readback before the output surfaces go away */
+    if (obj_output->capture) {
+        capture_destroy(obj_output->capture);
+        obj_output->capture = NULL;
+    }
+
     unsigned int i;
     for (i = 0; i < VDPAU_MAX_OUTPUT_SURFACES; i++) {
         VdpOutputSurface vdp_output_surface;
@@ -267,6 +313,9 @@ output_surface_destroy(
         }
     }
 
+    vector_free(&obj_output->mosaic_tiles);
+    vector_free(&obj_output->mosaic_shown);
+
     pthread_mutex_unlock(&obj_output->vdp_output_surfaces_lock);
     pthread_mutex_destroy(&obj_output->vdp_output_surfaces_lock);
     object_heap_free(&driver_data->output_heap, (object_base_p)obj_output);
@@ -312,10 +361,10 @@ output_surface_lookup(object_surface_p obj_surface, Drawable drawable)
     unsigned int i;
 
     if (obj_surface) {
-        for (i = 0; i < obj_surface->output_surfaces_count; i++) {
-            ASSERT(obj_surface->output_surfaces[i]);
-            if (obj_surface->output_surfaces[i]->drawable == drawable)
-                return obj_surface->output_surfaces[i];
+        for (i = 0; i < obj_surface->output_surfaces.count; i++) {
+            ASSERT(obj_surface->output_surfaces.data[i]);
+            if (obj_surface->output_surfaces.data[i]->drawable == drawable)
+                return obj_surface->output_surfaces.data[i];
         }
     }
     return NULL;
@@ -342,17 +391,27 @@ output_surface_ensure(
 
     /* ... that might have been created for another video surface */
     if (!obj_output) {
+        /* Pre-bound outputs may be released by vdpau_evict_caches() */
+        pthread_mutex_lock(&driver_data->cache_lock);
         object_heap_iterator iter;
         object_base_p obj = object_heap_first(&driver_data->output_heap, &iter);
         while (obj) {
             object_output_p m = (object_output_p)obj;
             if (m->drawable == drawable) {
-                obj_output = output_surface_ref(driver_data, m);
+                /* Take over the reference held by prebind_drawable() */
+                if (m->is_prebound) {
+                    m->is_prebound = 0;
+                    driver_data->prebound_outputs--;
+                    obj_output = m;
+                }
+                else
+                    obj_output = output_surface_ref(driver_data, m);
                 new_obj_output = 1;
                 break;
             }
             obj = object_heap_next(&driver_data->output_heap, &iter);
         }
+        pthread_mutex_unlock(&driver_data->cache_lock);
     }
 
     /* Fallback: create a new output surface */
@@ -365,12 +424,8 @@ output_surface_ensure(
 
     /* Append output surface */
     if (new_obj_output) {
-        if (realloc_buffer((void **)&obj_surface->output_surfaces,
-                           &obj_surface->output_surfaces_count_max,
-                           1 + obj_surface->output_surfaces_count,
-                           sizeof(*obj_surface->output_surfaces)) == NULL)
+        if (!vector_append(&obj_surface->output_surfaces, obj_output))
             return NULL;
-        obj_surface->output_surfaces[obj_surface->output_surfaces_count++] = obj_output;
     }
     return obj_output;
 }
@@ -385,54 +440,182 @@ ensure_bounds(VdpRect *rect, unsigned int width, unsigned int height)
     rect->y1 = MIN(rect->y1, height);
 }
 
-// Render surface to the VDPAU output surface
-VAStatus
-render_surface(
+// Get the background color set through vaSetDisplayAttributes()
+static uint32_t
+get_background_color(vdpau_driver_data_t *driver_data, VdpColor *vdp_color)
+{
+    uint32_t value = 0;
+    unsigned int i;
+
+    for (i = 0; i < driver_data->va_display_attrs_count; i++) {
+        VADisplayAttribute * const attr = &driver_data->va_display_attrs[i];
+        if (attr->type == VADisplayAttribBackgroundColor) {
+            value = attr->value;
+            break;
+        }
+    }
+    vdp_color->red   = ((value >> 16) & 0xff) / 255.0f;
+    vdp_color->green = ((value >> 8) & 0xff) / 255.0f;
+    vdp_color->blue  = (value & 0xff) / 255.0f;
+    vdp_color->alpha = 1.0f;
+    return value;
+}
+
+// Clear the output surface area around DST_RECT, unless it is already cleared
+static VdpStatus
+clear_borders(
     vdpau_driver_data_t *driver_data,
-    object_surface_p     obj_surface,
     object_output_p      obj_output,
-    const VARectangle   *source_rect,
-    const VARectangle   *target_rect,
+    const VdpRect       *dst_rect,
     unsigned int         flags
 )
 {
-    VdpRect src_rect;
-    src_rect.x0 = source_rect->x;
-    src_rect.y0 = source_rect->y;
-    src_rect.x1 = source_rect->x + source_rect->width;
-    src_rect.y1 = source_rect->y + source_rect->height;
-    ensure_bounds(&src_rect, obj_surface->width, obj_surface->height);   
-
-    VdpRect dst_rect;
-    dst_rect.x0 = target_rect->x;
-    dst_rect.y0 = target_rect->y;
-    dst_rect.x1 = target_rect->x + target_rect->width;
-    dst_rect.y1 = target_rect->y + target_rect->height;
-    ensure_bounds(&dst_rect, obj_output->width, obj_output->height);
+    const unsigned int i = obj_output->current_output_surface;
+    const unsigned int width = obj_output->width;
+    const unsigned int height = obj_output->height;
+    VdpColor vdp_color;
+    uint32_t color;
+
+    color = get_background_color(driver_data, &vdp_color);
+    if (!(flags & VA_CLEAR_DRAWABLE) &&
+        obj_output->borders_valid[i] &&
+        obj_output->border_colors[i] == color &&
+        memcmp(&obj_output->border_rects[i], dst_rect, sizeof(*dst_rect)) == 0)
+        return VDP_STATUS_OK;
+
+    /* Letterbox bars span the full width, pillarbox bars the video height */
+    VdpRect rects[4];
+    unsigned int n, num_rects = 0;
+    if (dst_rect->y0 > 0) {
+        rects[num_rects].x0 = 0;
+        rects[num_rects].y0 = 0;
+        rects[num_rects].x1 = width;
+        rects[num_rects].y1 = dst_rect->y0;
+        num_rects++;
+    }
+    if (dst_rect->y1 < height) {
+        rects[num_rects].x0 = 0;
+        rects[num_rects].y0 = dst_rect->y1;
+        rects[num_rects].x1 = width;
+        rects[num_rects].y1 = height;
+        num_rects++;
+    }
+    if (dst_rect->x0 > 0) {
+        rects[num_rects].x0 = 0;
+        rects[num_rects].y0 = dst_rect->y0;
+        rects[num_rects].x1 = dst_rect->x0;
+        rects[num_rects].y1 = dst_rect->y1;
+        num_rects++;
+    }
+    if (dst_rect->x1 < width) {
+        rects[num_rects].x0 = dst_rect->x1;
+        rects[num_rects].y0 = dst_rect->y0;
+        rects[num_rects].x1 = width;
+        rects[num_rects].y1 = dst_rect->y1;
+        num_rects++;
+    }
 
-    VdpOutputSurface vdp_background = VDP_INVALID_HANDLE;
-    if (!obj_output->size_changed && obj_output->queued_surfaces > 0) {
-        int background_surface;
-        background_surface = obj_output->displayed_output_surface;
-        if (obj_output->vdp_output_surfaces_dirty[background_surface])
-            vdp_background = obj_output->vdp_output_surfaces[background_surface];
+    for (n = 0; n < num_rects; n++) {
+        VdpStatus vdp_status;
+        vdp_status = vdpau_output_surface_render_output_surface(
+            driver_data,
+            obj_output->vdp_output_surfaces[i],
+            &rects[n],
+            VDP_INVALID_HANDLE,
+            NULL,
+            &vdp_color,
+            NULL,
+            0
+        );
+        if (!VDPAU_CHECK_STATUS(vdp_status, "VdpOutputSurfaceRenderOutputSurface()")) {
+            obj_output->borders_valid[i] = 0;
+            return vdp_status;
+        }
     }
 
+    obj_output->border_rects[i]  = *dst_rect;
+    obj_output->border_colors[i] = color;
+    obj_output->borders_valid[i] = 1;
+    return VDP_STATUS_OK;
+}
+
+// Compute the source and target rectangles of a surface on the output surface
+static void
+get_render_rects(
+    object_surface_p     obj_surface,
+    object_output_p      obj_output,
+    const VARectangle   *source_rect,
+    const VARectangle   *target_rect,
+    VdpRect             *src_rect,
+    VdpRect             *dst_rect
+)
+{
+    src_rect->x0 = source_rect->x;
+    src_rect->y0 = source_rect->y;
+    src_rect->x1 = source_rect->x + source_rect->width;
+    src_rect->y1 = source_rect->y + source_rect->height;
+    ensure_bounds(src_rect, obj_surface->width, obj_surface->height);
+
+    dst_rect->x0 = target_rect->x;
+    dst_rect->y0 = target_rect->y;
+    dst_rect->x1 = target_rect->x + target_rect->width;
+    dst_rect->y1 = target_rect->y + target_rect->height;
+    ensure_bounds(dst_rect, obj_output->width, obj_output->height);
+}
+
+// Mix surface into the video rectangle of the VDPAU output surface
+static VAStatus
+mix_surface(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface,
+    object_output_p      obj_output,
+    const VdpRect       *src_rect,
+    const VdpRect       *dst_rect,
+    unsigned int         flags
+)
+{
     VdpStatus vdp_status;
+
     vdp_status = video_mixer_render(
         driver_data,
         obj_surface->video_mixer,
         obj_surface,
-        vdp_background,
+        VDP_INVALID_HANDLE,
         obj_output->vdp_output_surfaces[obj_output->current_output_surface],
-        &src_rect,
-        &dst_rect,
+        src_rect,
+        dst_rect,
         flags
     );
     obj_output->vdp_output_surfaces_dirty[obj_output->current_output_surface] = 1;
     return vdpau_get_VAStatus(vdp_status);
 }
 
+// Render surface to the VDPAU output surface
+VAStatus
+render_surface(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface,
+    object_output_p      obj_output,
+    const VARectangle   *source_rect,
+    const VARectangle   *target_rect,
+    unsigned int         flags
+)
+{
+    VdpRect src_rect, dst_rect;
+    get_render_rects(obj_surface, obj_output, source_rect, target_rect,
+                     &src_rect, &dst_rect);
+
+    /* The mixer only writes the video rectangle, the surrounding area
+       keeps the color it was last cleared with */
+    VdpStatus vdp_status;
+    vdp_status = clear_borders(driver_data, obj_output, &dst_rect, flags);
+    if (vdp_status != VDP_STATUS_OK)
+        return vdpau_get_VAStatus(vdp_status);
+
+    return mix_surface(driver_data, obj_surface, obj_output,
+                       &src_rect, &dst_rect, flags);
+}
+
 // Render subpictures to the VDPAU output surface
 static VAStatus
 render_subpicture(
@@ -545,8 +728,8 @@ render_subpictures(
 )
 {
     unsigned int i;
-    for (i = 0; i < obj_surface->assocs_count; i++) {
-        SubpictureAssociationP const assoc = obj_surface->assocs[i];
+    for (i = 0; i < obj_surface->assocs.count; i++) {
+        SubpictureAssociationP const assoc = obj_surface->assocs.data[i];
         ASSERT(assoc);
         if (!assoc)
             continue;
@@ -572,6 +755,210 @@ render_subpictures(
     return VA_STATUS_SUCCESS;
 }
 
+// Get the stream frame duration used for cadence scheduling (0: disabled)
+static VdpTime
+get_frame_duration(void)
+{
+    static int g_frame_duration = -1;
+    if (g_frame_duration < 0) {
+        if (getenv_int("VDPAU_VIDEO_FRAME_DURATION", &g_frame_duration) < 0 ||
+            g_frame_duration < 0)
+            g_frame_duration = 0;
+    }
+    return (VdpTime)g_frame_duration * 1000;
+}
+
+// Shortest refresh period considered, presentations closer than that
+// are taken to be on the same vsync (in nanoseconds)
+#define CADENCE_MIN_PERIOD      2000000
+
+// Number of presentations the refresh period estimate must be consistent
+// with before frames are scheduled on its grid
+#define CADENCE_STABLE_SAMPLES  16
+
+// Update the refresh period estimate from the time a frame went on screen
+static void
+cadence_frame_presented(
+    object_output_p      obj_output,
+    unsigned int         index,
+    VdpTime              presented_time
+)
+{
+    const VdpTime scheduled_time = obj_output->scheduled_times[index];
+    VdpTime period = obj_output->vsync_period;
+
+    obj_output->scheduled_times[index] = 0;
+    if (!presented_time)
+        return;
+
+    /* Frames paced by the application are several vsyncs apart, e.g.
+       alternately 2 and 3 for 24p on 60 Hz. Every delta is a multiple
+       of the refresh period, so the estimate is reduced to the largest
+       period all deltas are multiples of, as in Euclid's algorithm */
+    if (obj_output->last_presented_time &&
+        presented_time > obj_output->last_presented_time + CADENCE_MIN_PERIOD) {
+        const VdpTime delta = presented_time - obj_output->last_presented_time;
+        const VdpTime n = period ? (delta + period / 2) / period : 0;
+        const VdpTime rem = n ? (delta > n * period ?
+                                 delta - n * period : n * period - delta) : 0;
+        if (n > 8)
+            ; /* A pause, too coarse to tell anything about the period */
+        else if (n > 0 && rem < period / 4) {
+            period = (7 * period + delta / n) / 8;
+            ++obj_output->vsync_period_samples;
+        }
+        else {
+            if (period && delta > period)
+                period = delta - (delta / period) * period;
+            else
+                period = delta;
+            if (period < CADENCE_MIN_PERIOD)
+                period = obj_output->vsync_period;
+            obj_output->vsync_period_samples = 0;
+        }
+        obj_output->vsync_period = period;
+    }
+    obj_output->last_presented_time = presented_time;
+
+    if (scheduled_time && period) {
+        const VdpTime error = presented_time > scheduled_time ?
+            presented_time - scheduled_time : scheduled_time - presented_time;
+        if (error > period / 2) {
+            D(bug("cadence break on drawable 0x%08x: frame %lld us late\n",
+                  (unsigned int)obj_output->drawable,
+                  ((long long)presented_time - (long long)scheduled_time) / 1000));
+            ++obj_output->cadence_breaks;
+            obj_output->cadence_base_time = 0;
+        }
+    }
+}
+
+// Tell the HQ scaling governor whether a frame went on screen later than expected
+static void
+hqscaling_frame_presented(
+    object_mixer_p       obj_mixer,
+    object_output_p      obj_output,
+    unsigned int         index,
+    VdpTime              presented_time
+)
+{
+    VdpTime expected_time = obj_output->queued_times[index];
+    VdpTime max_latency;
+
+    obj_output->queued_times[index] = 0;
+    if (!obj_mixer || !presented_time)
+        return;
+
+    /* A frame normally waits for the vsync after the one already
+       queued. Anything beyond that is mixing not keeping up */
+    if (obj_output->scheduled_times[index] > expected_time)
+        expected_time = obj_output->scheduled_times[index];
+    max_latency = obj_output->vsync_period ?
+        obj_output->vsync_period * 5 / 2 : 40000000;
+
+    video_mixer_hqscaling_feedback(
+        obj_mixer,
+        presented_time > expected_time + max_latency
+    );
+}
+
+// Compute the vsync the next frame is shown on, for an even cadence (0: ASAP)
+static VdpTime
+cadence_schedule(
+    vdpau_driver_data_t *driver_data,
+    object_output_p      obj_output
+)
+{
+    const VdpTime frame_duration = get_frame_duration();
+    const VdpTime period = obj_output->vsync_period;
+    const VdpTime anchor = obj_output->last_presented_time;
+    VdpTime now, target;
+    VdpStatus vdp_status;
+
+    /* Pixmaps are read back as soon as vaPutSurface() returns, e.g. by
+       vaCopySurfaceGLX(), so presents to them are never deferred */
+    if (!frame_duration || !period || !anchor || !obj_output->is_window)
+        return 0;
+
+    /* Wait for the refresh period estimate to settle */
+    if (obj_output->vsync_period_samples < CADENCE_STABLE_SAMPLES)
+        return 0;
+
+    vdp_status = vdpau_presentation_queue_get_time(
+        driver_data,
+        obj_output->vdp_flip_queue,
+        &now
+    );
+    if (vdp_status != VDP_STATUS_OK)
+        return 0;
+
+    /* Start a new cadence if the application fell behind. The base is
+       a quarter vsync off the grid so that frames never round on a tie
+       and a 2.5 vsync frame duration maps to an even 3:2 pattern */
+    if (obj_output->cadence_base_time) {
+        target = obj_output->cadence_base_time +
+            obj_output->cadence_frames * frame_duration;
+        if (target < now + period / 2) {
+            D(bug("cadence break on drawable 0x%08x: frame %lld us late\n",
+                  (unsigned int)obj_output->drawable,
+                  ((long long)now - (long long)target) / 1000));
+            ++obj_output->cadence_breaks;
+            obj_output->cadence_base_time = 0;
+        }
+    }
+    if (!obj_output->cadence_base_time) {
+        target = now + 2 * period;
+        if (target > anchor)
+            target -= (target - anchor) % period;
+        obj_output->cadence_base_time = target + period / 4;
+        obj_output->cadence_frames    = 0;
+    }
+
+    target = obj_output->cadence_base_time +
+        obj_output->cadence_frames * frame_duration;
+    ++obj_output->cadence_frames;
+
+    /* Snap to the vsync grid anchored at the last presentation */
+    if (target > anchor)
+        target = anchor + (target - anchor + period / 2) / period * period;
+    return target;
+}
+
+// Wait for the current output surface to complete its previous rendering
+static VAStatus
+output_surface_wait_idle(
+    vdpau_driver_data_t *driver_data,
+    object_output_p      obj_output,
+    object_mixer_p       obj_mixer
+)
+{
+    const unsigned int i = obj_output->current_output_surface;
+    VdpTime presented_time;
+    VdpStatus vdp_status;
+
+    if (obj_output->vdp_output_surfaces[i] == VDP_INVALID_HANDLE ||
+        !obj_output->vdp_output_surfaces_dirty[i])
+        return VA_STATUS_SUCCESS;
+
+    capture_wait_idle(obj_output->capture, obj_output->vdp_output_surfaces[i]);
+
+    vdp_status = vdpau_presentation_queue_block_until_surface_idle(
+        driver_data,
+        obj_output->vdp_flip_queue,
+        obj_output->vdp_output_surfaces[i],
+        &presented_time
+    );
+    if (!VDPAU_CHECK_STATUS(vdp_status, "VdpPresentationQueueBlockUntilSurfaceIdle()"))
+        return vdpau_get_VAStatus(vdp_status);
+
+    if (obj_output->queued_times[i])
+        hqscaling_frame_presented(obj_mixer, obj_output, i, presented_time);
+
+    if (get_frame_duration())
+        cadence_frame_presented(obj_output, i, presented_time);
+    return VA_STATUS_SUCCESS;
+}
+
 // Queue surface for display
 static VAStatus
 flip_surface_unlocked(
@@ -579,19 +966,40 @@ flip_surface_unlocked(
     object_output_p      obj_output
 )
 {
+    const VdpTime vsync_time = cadence_schedule(driver_data, obj_output);
     VdpStatus vdp_status;
+
+    /* The surface is shown on the first vsync after the given time */
     vdp_status = vdpau_presentation_queue_display(
         driver_data,
         obj_output->vdp_flip_queue,
         obj_output->vdp_output_surfaces[obj_output->current_output_surface],
         obj_output->width,
         obj_output->height,
-        0
+        vsync_time ? vsync_time - obj_output->vsync_period / 2 : 0
     );
     if (!VDPAU_CHECK_STATUS(vdp_status, "VdpPresentationQueueDisplay()"))
         return vdpau_get_VAStatus(vdp_status);
+    obj_output->scheduled_times[obj_output->current_output_surface] = vsync_time;
+
+    VdpTime * const queued_time =
+        &obj_output->queued_times[obj_output->current_output_surface];
+    if (!obj_output->track_latency ||
+        vdpau_presentation_queue_get_time(driver_data,
+                                          obj_output->vdp_flip_queue,
+                                          queued_time) != VDP_STATUS_OK)
+        *queued_time = 0;
+
+    if (obj_output->capture)
+        capture_output_surface(
+            obj_output->capture,
+            obj_output->vdp_output_surfaces[obj_output->current_output_surface],
+            obj_output->width,
+            obj_output->height
+        );
 
     obj_output->displayed_output_surface = obj_output->current_output_surface;
+    obj_output->displayed_status_time    = 0;
     obj_output->current_output_surface   =
         (++obj_output->queued_surfaces) % VDPAU_MAX_OUTPUT_SURFACES;
     return VA_STATUS_SUCCESS;
@@ -625,6 +1033,101 @@ queue_surface(
     return va_status;
 }
 
+// Get whether a surface put to several drawables is mixed only once
+static int
+get_mirror_env(void)
+{
+    static int g_mirror = -1;
+    if (g_mirror < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_MIRROR", &g_mirror) < 0)
+            g_mirror = 0;
+    }
+    return g_mirror;
+}
+
+// Copy the picture already mixed for another drawable, returns 0 if there is none
+static int
+mirror_surface_unlocked(
+    vdpau_driver_data_t *driver_data,
+    object_surface_p     obj_surface,
+    object_output_p      obj_output,
+    const VARectangle   *source_rect,
+    const VARectangle   *target_rect,
+    unsigned int         flags
+)
+{
+    object_output_p src_output;
+    VdpOutputSurface vdp_output_surface;
+    VdpRect dst_rect;
+    VdpStatus vdp_status;
+
+    if (obj_surface->mirror_output_id == VA_INVALID_ID ||
+        obj_surface->mirror_output_id == obj_output->base.id ||
+        obj_surface->mirror_flags != flags ||
+        memcmp(&obj_surface->mirror_src_rect, source_rect, sizeof(*source_rect)) != 0)
+        return 0;
+
+    /* The mixed picture must not have been overwritten by later flips */
+    src_output = VDPAU_OUTPUT(obj_surface->mirror_output_id);
+    if (!src_output ||
+        src_output->queued_surfaces != obj_surface->mirror_sequence ||
+        src_output->vdp_output_surfaces[src_output->displayed_output_surface] !=
+        obj_surface->mirror_output_surface)
+        return 0;
+
+    dst_rect.x0 = target_rect->x;
+    dst_rect.y0 = target_rect->y;
+    dst_rect.x1 = target_rect->x + target_rect->width;
+    dst_rect.y1 = target_rect->y + target_rect->height;
+    ensure_bounds(&dst_rect, obj_output->width, obj_output->height);
+
+    vdp_output_surface =
+        obj_output->vdp_output_surfaces[obj_output->current_output_surface];
+
+    vdp_status = clear_borders(driver_data, obj_output, &dst_rect, flags);
+    if (vdp_status != VDP_STATUS_OK)
+        return 0;
+
+    vdp_status = vdpau_output_surface_render_output_surface(
+        driver_data,
+        vdp_output_surface,
+        &dst_rect,
+        obj_surface->mirror_output_surface,
+        &obj_surface->mirror_dst_rect,
+        NULL,
+        NULL,
+        0
+    );
+    if (!VDPAU_CHECK_STATUS(vdp_status, "VdpOutputSurfaceRenderOutputSurface()"))
+        return 0;
+
+    obj_output->vdp_output_surfaces_dirty[obj_output->current_output_surface] = 1;
+    return 1;
+}
+
+// Release pre-bound outputs that were not presented to in time
+static void
+expire_prebound_outputs(vdpau_driver_data_t *driver_data, uint64_t now)
+{
+    if (driver_data->prebound_outputs == 0)
+        return;
+
+    pthread_mutex_lock(&driver_data->cache_lock);
+    object_heap_iterator iter;
+    object_base_p obj = object_heap_first(&driver_data->output_heap, &iter);
+    while (obj) {
+        object_output_p const obj_output = (object_output_p)obj;
+        obj = object_heap_next(&driver_data->output_heap, &iter);
+        if (obj_output->is_prebound &&
+            now - obj_output->prebind_time >= PREBIND_TIMEOUT) {
+            D(bug("release unused pre-bound drawable 0x%08x\n",
+                  (unsigned int)obj_output->drawable));
+            output_surface_destroy(driver_data, obj_output);
+        }
+    }
+    pthread_mutex_unlock(&driver_data->cache_lock);
+}
+
 // Render surface to a Drawable
 static VAStatus
 put_surface_unlocked(
@@ -636,25 +1139,31 @@ put_surface_unlocked(
     unsigned int         flags
 )
 {
-    VdpStatus vdp_status;
     VAStatus va_status;
 
     obj_surface->va_surface_status = VASurfaceReady;
 
-    /* Wait for the output surface to be ready.
-       i.e. it completed the previous rendering */
-    if (obj_output->vdp_output_surfaces[obj_output->current_output_surface] != VDP_INVALID_HANDLE &&
-        obj_output->vdp_output_surfaces_dirty[obj_output->current_output_surface]) {
-        VdpTime dummy_time;
-        vdp_status = vdpau_presentation_queue_block_until_surface_idle(
-            driver_data,
-            obj_output->vdp_flip_queue,
-            obj_output->vdp_output_surfaces[obj_output->current_output_surface],
-            &dummy_time
-        );
-        if (!VDPAU_CHECK_STATUS(vdp_status, "VdpPresentationQueueBlockUntilSurfaceIdle()"))
-            return vdpau_get_VAStatus(vdp_status);
-    }
+    va_status = output_surface_wait_idle(
+        driver_data,
+        obj_output,
+        obj_surface->video_mixer
+    );
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
+
+    /* Only part of the drawable is mixed, the mosaic must be redrawn */
+    vector_clear(&obj_output->mosaic_shown);
+
+    obj_output->track_latency =
+        (flags & VA_FILTER_SCALING_MASK) == VA_FILTER_SCALING_HQ;
+
+    /* Only whole frames are mirrored, field puts are mixed separately */
+    int fields = flags & (VA_TOP_FIELD|VA_BOTTOM_FIELD);
+    int is_frame = !fields || fields == (VA_TOP_FIELD|VA_BOTTOM_FIELD);
+    if (is_frame && get_mirror_env() &&
+        mirror_surface_unlocked(driver_data, obj_surface, obj_output,
+                                source_rect, target_rect, flags))
+        return queue_surface_unlocked(driver_data, obj_surface, obj_output);
 
     /* Render the video surface to the output surface */
     va_status = render_surface(
@@ -680,7 +1189,6 @@ put_surface_unlocked(
         return va_status;
 
     /* Queue surface for display, if the picture is complete (all fields mixed in) */
-    int fields = flags & (VA_TOP_FIELD|VA_BOTTOM_FIELD);
     if (!fields)
         fields = VA_TOP_FIELD|VA_BOTTOM_FIELD;
 
@@ -689,6 +1197,22 @@ put_surface_unlocked(
         va_status = queue_surface_unlocked(driver_data, obj_surface, obj_output);
         if (va_status != VA_STATUS_SUCCESS)
             return va_status;
+
+        /* Other drawables showing this surface can copy the mixed picture */
+        if (is_frame) {
+            VdpRect * const dst_rect = &obj_surface->mirror_dst_rect;
+            dst_rect->x0 = target_rect->x;
+            dst_rect->y0 = target_rect->y;
+            dst_rect->x1 = target_rect->x + target_rect->width;
+            dst_rect->y1 = target_rect->y + target_rect->height;
+            ensure_bounds(dst_rect, obj_output->width, obj_output->height);
+            obj_surface->mirror_output_id      = obj_output->base.id;
+            obj_surface->mirror_output_surface =
+                obj_output->vdp_output_surfaces[obj_output->displayed_output_surface];
+            obj_surface->mirror_sequence       = obj_output->queued_surfaces;
+            obj_surface->mirror_flags          = flags;
+            obj_surface->mirror_src_rect       = *source_rect;
+        }
     }
     return VA_STATUS_SUCCESS;
 }
@@ -712,6 +1236,13 @@ put_surface(
     if (!obj_surface)
         return VA_STATUS_ERROR_INVALID_SURFACE;
 
+    /* The picture was shed by vaEndPicture(): nothing is queued, so the
+       previous frame stays on screen */
+    if (obj_surface->is_shed)
+        return VA_STATUS_SUCCESS;
+
+    expire_prebound_outputs(driver_data, get_ticks_usec());
+
     object_output_p obj_output;
     obj_output = output_surface_ensure(
         driver_data,
@@ -764,6 +1295,497 @@ put_surface(
     return va_status;
 }
 
+// Look up the tile of the displayed mosaic covering the same area
+static vdpau_mosaic_tile_t *
+mosaic_shown_lookup(object_output_p obj_output, const VARectangle *dst_rect)
+{
+    unsigned int i;
+
+    for (i = 0; i < obj_output->mosaic_shown.count; i++) {
+        vdpau_mosaic_tile_t * const tile = &obj_output->mosaic_shown.data[i];
+        if (memcmp(&tile->dst_rect, dst_rect, sizeof(*dst_rect)) == 0)
+            return tile;
+    }
+    return NULL;
+}
+
+// Check whether a tile shows the same picture as in the displayed mosaic
+static int
+mosaic_tile_is_shown(
+    object_output_p            obj_output,
+    object_surface_p           obj_surface,
+    const vdpau_mosaic_tile_t *tile
+)
+{
+    const vdpau_mosaic_tile_t *shown_tile;
+
+    shown_tile = mosaic_shown_lookup(obj_output, &tile->dst_rect);
+    return (shown_tile &&
+            shown_tile->surface      == tile->surface &&
+            shown_tile->update_count == obj_surface->update_count &&
+            shown_tile->flags        == tile->flags &&
+            memcmp(&shown_tile->src_rect, &tile->src_rect,
+                   sizeof(tile->src_rect)) == 0);
+}
+
+// Render several surfaces to the current output surface and queue it for display
+static VAStatus
+put_surface_mosaic_unlocked(
+    vdpau_driver_data_t *driver_data,
+    object_output_p      obj_output,
+    vdpau_mosaic_tile_t *tiles,
+    unsigned int         num_tiles
+)
+{
+    const unsigned int current = obj_output->current_output_surface;
+    const unsigned int displayed = obj_output->displayed_output_surface;
+    object_surface_p obj_surface;
+    vdpau_mosaic_tile_t *shown_tile;
+    VdpRect rect, src_rect, dst_rect;
+    VdpStatus vdp_status;
+    VAStatus va_status;
+    unsigned int i, num_changed_tiles;
+
+    /* Only the changed tiles are mixed over the displayed mosaic. It
+       is redrawn from scratch when the drawable was resized or cleared */
+    int is_update = (obj_output->mosaic_shown.count > 0 &&
+                     !obj_output->size_changed &&
+                     displayed != current &&
+                     obj_output->vdp_output_surfaces[displayed] != VDP_INVALID_HANDLE);
+
+    num_changed_tiles = 0;
+    for (i = 0; i < num_tiles; i++) {
+        obj_surface = VDPAU_SURFACE(tiles[i].surface);
+        if (!obj_surface)
+            return VA_STATUS_ERROR_INVALID_SURFACE;
+        if (tiles[i].flags & VA_CLEAR_DRAWABLE)
+            is_update = 0;
+        if (obj_surface->is_shed)
+            continue;
+        if (!mosaic_tile_is_shown(obj_output, obj_surface, &tiles[i]))
+            ++num_changed_tiles;
+    }
+    if (!is_update)
+        vector_clear(&obj_output->mosaic_shown);
+    else if (num_changed_tiles == 0)
+        return VA_STATUS_SUCCESS;
+
+    obj_surface = VDPAU_SURFACE(tiles[0].surface);
+    va_status = output_surface_wait_idle(
+        driver_data,
+        obj_output,
+        obj_surface->video_mixer
+    );
+    if (va_status != VA_STATUS_SUCCESS)
+        return va_status;
+
+    rect.x0 = 0;
+    rect.y0 = 0;
+    rect.x1 = obj_output->width;
+    rect.y1 = obj_output->height;
+    if (is_update)
+        vdp_status = vdpau_output_surface_render_output_surface(
+            driver_data,
+            obj_output->vdp_output_surfaces[current],
+            &rect,
+            obj_output->vdp_output_surfaces[displayed],
+            &rect,
+            NULL,
+            NULL,
+            0
+        );
+    else {
+        VdpColor vdp_color;
+        get_background_color(driver_data, &vdp_color);
+        vdp_status = vdpau_output_surface_render_output_surface(
+            driver_data,
+            obj_output->vdp_output_surfaces[current],
+            &rect,
+            VDP_INVALID_HANDLE,
+            NULL,
+            &vdp_color,
+            NULL,
+            0
+        );
+    }
+    if (!VDPAU_CHECK_STATUS(vdp_status, "VdpOutputSurfaceRenderOutputSurface()"))
+        return vdpau_get_VAStatus(vdp_status);
+    obj_output->vdp_output_surfaces_dirty[current] = 1;
+    obj_output->borders_valid[current] = 0;
+
+    for (i = 0; i < num_tiles; i++) {
+        vdpau_mosaic_tile_t * const tile = &tiles[i];
+
+        obj_surface = VDPAU_SURFACE(tile->surface);
+
+        /* The picture was shed by vaEndPicture() and holds stale data.
+           Its area repeats the previous picture, copied above, or keeps
+           the background on a full redraw. No picture is recorded for
+           it then, so that the area is mixed again once updated */
+        if (obj_surface->is_shed)
+            continue;
+
+        obj_surface->va_surface_status = VASurfaceDisplaying;
+        if (mosaic_tile_is_shown(obj_output, obj_surface, tile))
+            continue;
+
+        get_render_rects(obj_surface, obj_output,
+                         &tile->src_rect, &tile->dst_rect,
+                         &src_rect, &dst_rect);
+
+        va_status = mix_surface(driver_data, obj_surface, obj_output,
+                                &src_rect, &dst_rect, tile->flags);
+        if (va_status != VA_STATUS_SUCCESS)
+            return va_status;
+
+        va_status = render_subpictures(
+            driver_data,
+            obj_surface,
+            obj_output,
+            &tile->src_rect,
+            &tile->dst_rect
+        );
+        if (va_status != VA_STATUS_SUCCESS)
+            return va_status;
+
+        /* Record the picture now shown in that area */
+        tile->update_count = obj_surface->update_count;
+        shown_tile = mosaic_shown_lookup(obj_output, &tile->dst_rect);
+        if (shown_tile)
+            *shown_tile = *tile;
+        else if (!vector_append(&obj_output->mosaic_shown, *tile))
+            return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    obj_output->fields        = 0;
+    obj_output->track_latency = 0;
+    return flip_surface_unlocked(driver_data, obj_output);
+}
+
+// Render several surfaces to a Drawable, presenting them once
+VAStatus
+put_surface_mosaic(
+    vdpau_driver_data_t *driver_data,
+    Drawable             drawable,
+    unsigned int         drawable_width,
+    unsigned int         drawable_height,
+    vdpau_mosaic_tile_t *tiles,
+    unsigned int         num_tiles
+)
+{
+    object_output_p obj_output = NULL;
+    VAStatus va_status;
+    unsigned int i;
+    int status;
+
+    if (num_tiles == 0)
+        return VA_STATUS_SUCCESS;
+
+    /* All surfaces share the output surface of the drawable */
+    for (i = 0; i < num_tiles; i++) {
+        object_surface_p obj_surface = VDPAU_SURFACE(tiles[i].surface);
+        if (!obj_surface)
+            return VA_STATUS_ERROR_INVALID_SURFACE;
+
+        obj_output = output_surface_ensure(
+            driver_data,
+            obj_surface,
+            drawable,
+            drawable_width,
+            drawable_height
+        );
+        if (!obj_output)
+            return VA_STATUS_ERROR_INVALID_SURFACE;
+    }
+
+    ASSERT(obj_output->drawable == drawable);
+    ASSERT(obj_output->vdp_flip_queue != VDP_INVALID_HANDLE);
+    ASSERT(obj_output->vdp_flip_target != VDP_INVALID_HANDLE);
+
+    output_surface_lock(obj_output);
+    status = output_surface_ensure_size(
+        driver_data,
+        obj_output,
+        drawable_width,
+        drawable_height
+    );
+    output_surface_unlock(obj_output);
+    if (status < 0)
+        return VA_STATUS_ERROR_OPERATION_FAILED;
+
+    output_surface_lock(obj_output);
+    va_status = put_surface_mosaic_unlocked(
+        driver_data,
+        obj_output,
+        tiles,
+        num_tiles
+    );
+    output_surface_unlock(obj_output);
+    return va_status;
+}
+
+// Get whether vaPutSurface() calls to a drawable are composed into a mosaic
+static int
+get_mosaic_env(void)
+{
+    static int g_mosaic = -1;
+    if (g_mosaic < 0) {
+        if (getenv_yesno("VDPAU_VIDEO_MOSAIC", &g_mosaic) < 0)
+            g_mosaic = 0;
+    }
+    return g_mosaic;
+}
+
+// Get how long collected tiles wait for the rest of their round (in usec)
+static inline uint64_t
+mosaic_round_timeout(object_output_p obj_output)
+{
+    return obj_output->vsync_period ? obj_output->vsync_period / 1000 : 16667;
+}
+
+// Compose and present the tiles collected for a drawable
+static VAStatus
+mosaic_flush(
+    vdpau_driver_data_t *driver_data,
+    object_output_p      obj_output,
+    unsigned int         drawable_width,
+    unsigned int         drawable_height
+)
+{
+    VAStatus va_status;
+    unsigned int i;
+
+    /* Surfaces may have been destroyed in the meantime */
+    for (i = 0; i < obj_output->mosaic_tiles.count; ) {
+        if (!VDPAU_SURFACE(obj_output->mosaic_tiles.data[i].surface))
+            vector_remove_fast(&obj_output->mosaic_tiles, i);
+        else
+            i++;
+    }
+    va_status = put_surface_mosaic(
+        driver_data,
+        obj_output->drawable,
+        drawable_width,
+        drawable_height,
+        obj_output->mosaic_tiles.data,
+        obj_output->mosaic_tiles.count
+    );
+    vector_clear(&obj_output->mosaic_tiles);
+    return va_status;
+}
+
+// Check whether the collected tiles of a drawable are to be composed now
+static int
+mosaic_needs_flush(object_output_p obj_output, VASurfaceID surface, uint64_t now)
+{
+    unsigned int i;
+
+    if (obj_output->mosaic_tiles.count == 0)
+        return 0;
+    if (surface == VA_INVALID_SURFACE)
+        return 1;
+    if (now >= obj_output->mosaic_start + mosaic_round_timeout(obj_output))
+        return 1;
+    for (i = 0; i < obj_output->mosaic_tiles.count; i++) {
+        if (obj_output->mosaic_tiles.data[i].surface == surface)
+            return 1;
+    }
+    return 0;
+}
+
+// Compose the pending mosaic rounds that hold SURFACE or are overdue,
+// or all of them if SURFACE is VA_INVALID_SURFACE
+VAStatus
+flush_surface_mosaics(vdpau_driver_data_t *driver_data, VASurfaceID surface)
+{
+    if (!get_mosaic_env())
+        return VA_STATUS_SUCCESS;
+
+    const uint64_t now = get_ticks_usec();
+    VAStatus va_status = VA_STATUS_SUCCESS;
+
+    /* Composing looks up outputs under cache_lock, so only pick the
+       output under the lock. Each flush empties its round */
+    for (;;) {
+        object_output_p obj_output = NULL;
+        pthread_mutex_lock(&driver_data->cache_lock);
+        object_heap_iterator iter;
+        object_base_p obj = object_heap_first(&driver_data->output_heap, &iter);
+        while (obj) {
+            object_output_p const m = (object_output_p)obj;
+            if (mosaic_needs_flush(m, surface, now)) {
+                /* Keep the output alive while composing without the lock */
+                obj_output = output_surface_ref(driver_data, m);
+                break;
+            }
+            obj = object_heap_next(&driver_data->output_heap, &iter);
+        }
+        pthread_mutex_unlock(&driver_data->cache_lock);
+        if (!obj_output)
+            break;
+
+        VAStatus status = mosaic_flush(
+            driver_data,
+            obj_output,
+            obj_output->width,
+            obj_output->height
+        );
+        output_surface_unref(driver_data, obj_output);
+        if (va_status == VA_STATUS_SUCCESS)
+            va_status = status;
+    }
+    return va_status;
+}
+
+// Collect a tile of the drawable mosaic, composing the previous ones first
+// if this starts a new round or they waited for a whole refresh period
+static VAStatus
+put_surface_tile(
+    vdpau_driver_data_t *driver_data,
+    VASurfaceID          surface,
+    Drawable             drawable,
+    unsigned int         drawable_width,
+    unsigned int         drawable_height,
+    const VARectangle   *source_rect,
+    const VARectangle   *target_rect,
+    unsigned int         flags
+)
+{
+    const uint64_t now = get_ticks_usec();
+    VAStatus va_status;
+    unsigned int i;
+
+    object_surface_p obj_surface = VDPAU_SURFACE(surface);
+    if (!obj_surface)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    object_output_p obj_output;
+    obj_output = output_surface_ensure(
+        driver_data,
+        obj_surface,
+        drawable,
+        drawable_width,
+        drawable_height
+    );
+    if (!obj_output)
+        return VA_STATUS_ERROR_INVALID_SURFACE;
+
+    vdpau_mosaic_tile_t tile;
+    tile.surface      = surface;
+    tile.src_rect     = *source_rect;
+    tile.dst_rect     = *target_rect;
+    tile.flags        = flags;
+    tile.update_count = 0;
+
+    int flush = (obj_output->mosaic_tiles.count > 0 &&
+                 now >= obj_output->mosaic_start +
+                 mosaic_round_timeout(obj_output));
+
+    /* Tiles are put in turn, so an area put again starts a new round */
+    for (i = 0; i < obj_output->mosaic_tiles.count && !flush; i++) {
+        if (memcmp(&obj_output->mosaic_tiles.data[i].dst_rect, target_rect,
+                   sizeof(*target_rect)) == 0)
+            flush = 1;
+    }
+
+    if (flush) {
+        va_status = mosaic_flush(
+            driver_data,
+            obj_output,
+            drawable_width,
+            drawable_height
+        );
+        if (va_status != VA_STATUS_SUCCESS)
+            return va_status;
+    }
+
+    /* Only drawables receiving distinct areas are composed in rounds.
+       A single stream, put to the same area each time, is presented
+       right away and does not pay a round of latency */
+    const VARectangle * const last_rect = &obj_output->mosaic_last_rect;
+    const int is_single_area = (
+        obj_output->mosaic_tiles.count == 0 &&
+        ((last_rect->width == 0 && last_rect->height == 0) ||
+         memcmp(last_rect, target_rect, sizeof(*target_rect)) == 0)
+    );
+    obj_output->mosaic_last_rect = *target_rect;
+    if (is_single_area)
+        return put_surface(driver_data, surface, drawable,
+                           drawable_width, drawable_height,
+                           source_rect, target_rect, flags);
+
+    if (obj_output->mosaic_tiles.count == 0)
+        obj_output->mosaic_start = now;
+    if (!vector_append(&obj_output->mosaic_tiles, tile))
+        return VA_STATUS_ERROR_ALLOCATION_FAILED;
+    return VA_STATUS_SUCCESS;
+}
+
+// Prepare presentation queue and output surfaces for a drawable
+static VAStatus
+prebind_drawable(
+    vdpau_driver_data_t *driver_data,
+    Drawable             drawable,
+    unsigned int         width,
+    unsigned int         height
+)
+{
+    const uint64_t now = get_ticks_usec();
+    expire_prebound_outputs(driver_data, now);
+
+    /* The output is looked up, built and marked pre-bound in a single
+       cache_lock section: output_surface_ensure() only looks outputs up
+       by drawable under that lock, so it cannot pick this one before it
+       is complete and owned by prebind_drawable(). Concurrent pre-binds
+       of a drawable also create a single output. Creating VDPAU objects
+       may evict caches, which only try-locks cache_lock and skips
+       eviction then */
+    pthread_mutex_lock(&driver_data->cache_lock);
+    object_heap_iterator iter;
+    object_base_p obj = object_heap_first(&driver_data->output_heap, &iter);
+    while (obj) {
+        object_output_p const m = (object_output_p)obj;
+        if (m->drawable == drawable) {
+            /* Pre-binding again keeps the prepared output alive */
+            if (m->is_prebound)
+                m->prebind_time = now;
+            pthread_mutex_unlock(&driver_data->cache_lock);
+            return VA_STATUS_SUCCESS;
+        }
+        obj = object_heap_next(&driver_data->output_heap, &iter);
+    }
+
+    VAStatus va_status = VA_STATUS_SUCCESS;
+    object_output_p obj_output;
+    obj_output = output_surface_create(driver_data, drawable, width, height);
+    if (!obj_output)
+        va_status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+    else {
+        /* Allocate the whole output surface ring, not only the current one */
+        unsigned int i;
+        for (i = 0; i < VDPAU_MAX_OUTPUT_SURFACES; i++) {
+            obj_output->current_output_surface = i;
+            if (output_surface_ensure_size(driver_data, obj_output,
+                                           width, height) < 0) {
+                va_status = VA_STATUS_ERROR_ALLOCATION_FAILED;
+                break;
+            }
+        }
+        obj_output->current_output_surface = 0;
+
+        /* Nobody else could reference the output yet */
+        if (va_status != VA_STATUS_SUCCESS)
+            output_surface_destroy(driver_data, obj_output);
+        else {
+            obj_output->is_prebound  = 1;
+            obj_output->prebind_time = now;
+            driver_data->prebound_outputs++;
+        }
+    }
+    pthread_mutex_unlock(&driver_data->cache_lock);
+    return va_status;
+}
+
 // vaPutSurface
 VAStatus
 vdpau_PutSurface(
@@ -805,5 +1827,20 @@ vdpau_PutSurface(
     dst_rect.y      = desty;
     dst_rect.width  = destw;
     dst_rect.height = desth;
+
+    /* Pre-binding: vaPutSurface() with VA_INVALID_SURFACE displays
+       nothing. It only creates the presentation queue and output
+       surfaces for the drawable at its current size, so that the first
+       real frame does not pay for them. The source and target rects
+       and flags are ignored. The prepared output is taken over by the
+       first surface put to the drawable, or released if none is within
+       PREBIND_TIMEOUT. */
+    if (surface == VA_INVALID_SURFACE)
+        return prebind_drawable(driver_data, xid, w, h);
+
+    if (get_mosaic_env())
+        return put_surface_tile(driver_data, surface, xid, w, h,
+                                &src_rect, &dst_rect, flags);
+
     return put_surface(driver_data, surface, xid, w, h, &src_rect, &dst_rect, flags);
 }
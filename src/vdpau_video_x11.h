@@ -24,6 +24,18 @@
 #include "vdpau_driver.h"
 #include <pthread.h>
 #include "uasyncqueue.h"
+#include "uvector.h"
+#include "vdpau_capture.h"
+
+/* A surface shown in a region of a mosaic */
+typedef struct vdpau_mosaic_tile vdpau_mosaic_tile_t;
+struct vdpau_mosaic_tile {
+    VASurfaceID                 surface;
+    VARectangle                 src_rect;
+    VARectangle                 dst_rect;
+    unsigned int                flags;
+    unsigned int                update_count; /* surface update_count when mixed */
+};
 
 typedef struct object_output object_output_t;
 struct object_output {
@@ -38,13 +50,34 @@ struct object_output {
     VdpPresentationQueueTarget  vdp_flip_target;
     VdpOutputSurface            vdp_output_surfaces[VDPAU_MAX_OUTPUT_SURFACES];
     unsigned int                vdp_output_surfaces_dirty[VDPAU_MAX_OUTPUT_SURFACES];
+    VdpRect                     border_rects[VDPAU_MAX_OUTPUT_SURFACES];   /* video area the borders were cleared around */
+    uint32_t                    border_colors[VDPAU_MAX_OUTPUT_SURFACES];  /* color the borders were cleared with */
+    unsigned int                borders_valid[VDPAU_MAX_OUTPUT_SURFACES];
     pthread_mutex_t             vdp_output_surfaces_lock;
     unsigned int                current_output_surface;
     unsigned int                displayed_output_surface;
+    VdpPresentationQueueStatus  displayed_status;      /* cached status of the displayed output surface */
+    uint64_t                    displayed_status_time; /* time displayed_status was queried, 0 if invalid */
     unsigned int                queued_surfaces;
+    VdpTime                     scheduled_times[VDPAU_MAX_OUTPUT_SURFACES]; /* vsync targeted by each queued surface, 0 if none */
+    VdpTime                     queued_times[VDPAU_MAX_OUTPUT_SURFACES];    /* time each surface was queued, 0 if not tracked */
+    VdpTime                     last_presented_time;   /* time the previous frame went on screen */
+    VdpTime                     vsync_period;          /* display refresh period measured from presentation times */
+    unsigned int                vsync_period_samples;  /* consecutive presentations consistent with vsync_period */
+    VdpTime                     cadence_base_time;     /* target time of the first frame of the cadence */
+    unsigned int                cadence_frames;        /* frames scheduled since cadence_base_time */
+    unsigned int                cadence_breaks;
+    vdpau_capture_t            *capture;               /* composited frames tap, NULL if disabled */
+    UVECTOR(vdpau_mosaic_tile_t, 4) mosaic_tiles;      /* tiles collected for the next mosaic */
+    UVECTOR(vdpau_mosaic_tile_t, 4) mosaic_shown;      /* tiles of the displayed mosaic */
+    uint64_t                    mosaic_start;          /* time the first collected tile was put */
+    VARectangle                 mosaic_last_rect;      /* target of the previous vaPutSurface(), empty if none */
+    uint64_t                    prebind_time;          /* time prebind_drawable() last prepared it */
     unsigned int                fields;
     unsigned int                is_window    : 1; /* drawable is a window */
     unsigned int                size_changed : 1; /* size changed since previous vaPutSurface() and user noticed the change */
+    unsigned int                is_prebound  : 1; /* created by prebind_drawable(), not yet used by any surface */
+    unsigned int                track_latency : 1; /* record queue times, for the HQ scaling governor */
 };
 
 // Create output surface
@@ -126,6 +159,23 @@ put_surface(
     unsigned int         flags
 ) attribute_hidden;
 
+// Render several surfaces to a Drawable, presenting them once
+VAStatus
+put_surface_mosaic(
+    vdpau_driver_data_t *driver_data,
+    Drawable             drawable,
+    unsigned int         drawable_width,
+    unsigned int         drawable_height,
+    vdpau_mosaic_tile_t *tiles,
+    unsigned int         num_tiles
+) attribute_hidden;
+
+// Compose the pending mosaic rounds that hold SURFACE or are overdue,
+// or all of them if SURFACE is VA_INVALID_SURFACE
+VAStatus
+flush_surface_mosaics(vdpau_driver_data_t *driver_data, VASurfaceID surface)
+    attribute_hidden;
+
 // Queue surface for display
 VAStatus
 queue_surface(